@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <array>
+
 #include "ipc.hpp"
 #include "types.hpp"
 
@@ -89,4 +91,10 @@ void transact(IPCContext &ctx, u32 code, u32 flags);
 
 u32 findFreeBufferQueue();
 
+using State = std::array<BufferQueue, MAX_BUFFER_QUEUES>;
+
+// Buffer queues, saved by snapshots
+void getState(State &state);
+void setState(const State &state);
+
 }
@@ -18,6 +18,9 @@
 
 #pragma once
 
+#include <utility>
+#include <vector>
+
 #include "handle.hpp"
 #include "object.hpp"
 #include "types.hpp"
@@ -34,4 +37,10 @@ KObject *getLast();
 
 KPort *getPort(const char *name);
 
+// Returns all live objects of a type
+std::vector<KObject *> getObjects(u32 type);
+
+// Returns all live handles and their objects
+std::vector<std::pair<Handle, KObject *>> getHandles();
+
 }
@@ -649,7 +649,7 @@ public:
         }
 
         data.resize(d->size);
-        std::memcpy(data.data(), sys::memory::getPointer(d->address), d->size);
+        sys::memory::readBlock(d->address, data.data(), d->size);
 
         return data;
     }
@@ -679,7 +679,7 @@ public:
         
         size = std::min((u64)output.size(), size);
 
-        std::memcpy(sys::memory::getPointer(address), output.data(), size);
+        sys::memory::writeBlock(address, output.data(), size);
 
         return size;
     }
@@ -18,10 +18,14 @@
 
 #pragma once
 
+#include <array>
+#include <deque>
 #include <ios>
+#include <mutex>
 
 #include <plog/Log.h>
 
+#include "cpu.hpp"
 #include "handle.hpp"
 #include "handle_table.hpp"
 #include "object.hpp"
@@ -64,6 +68,24 @@ Handle makeService() {
 void startThread(Handle handle);
 void setActiveThread(KThread *thread);
 
+KThread *getActiveThread();
+
+void setThreadCore(KThread *thread, i32 processorID);
+
+// Picks the next thread to run on the current core, returns false if the core is idle
+bool schedule();
+
+std::mutex &getLock();
+
+struct SchedulerState {
+    std::array<KThread *, sys::cpu::CORE_NUM> activeThreads;
+    std::array<std::deque<KThread *>, sys::cpu::CORE_NUM> runQueues;
+};
+
+// NOTE: only safe while the cores are paused, thread contexts aren't synced with the JIT
+void getSchedulerState(SchedulerState &state);
+void setSchedulerState(const SchedulerState &state);
+
 void destroyServiceSession(Handle handle);
 void destroySession(Handle handle);
 
@@ -0,0 +1,37 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "types.hpp"
+
+namespace hle::libc {
+
+// SVC numbers used by patched routines (real SVCs are < 0x80)
+constexpr u32 HOOK_BASE = 0x8000;
+
+inline bool isHook(u32 svc) {
+    return svc >= HOOK_BASE;
+}
+
+// Replaces known libc routines in guest code with host implementations
+void patch();
+
+void handleHook(u32 svc);
+
+}
@@ -166,10 +166,14 @@ public:
 
     ThreadContext *getCtx();
 
+    ThreadStatus getStatus();
+    i32 getPriority();
+    i32 getProcessorID();
     u64 getTLSBase();
 
     void setTLSBase(u64 tlsBase);
 
+    void setStatus(ThreadStatus status);
     void setPriority(i32 priority);
     void setProcessorID(i32 processorID);
 
@@ -27,6 +27,7 @@ namespace KernelResult {
         Success = 0,
         NoDataInChannel = 0x480,
         NoAppletMessages = 0x680,
+        InvalidCurrentMemory = 0xD401,
         PortSdCardNoDevice = 0xFA202,
     };
 }
@@ -24,6 +24,10 @@ namespace hle::svc {
 
 void handleSVC(u32 svc);
 
+// Idle loop detection
+bool isPollingSVC(u32 svc);
+u64 getPollingResult(u32 svc);
+
 void svcBreak();
 void svcCloseHandle();
 void svcConnectToNamedPort();
@@ -43,6 +47,7 @@ void svcSetMemoryAttribute();
 void svcSetThreadCoreMask();
 void svcSignalProcessWideKey();
 void svcStartThread();
+void svcUnmapMemory();
 void svcUnmapSharedMemory();
 void svcWaitProcessWideKeyAtomic();
 void svcWaitSynchronization();
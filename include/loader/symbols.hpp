@@ -0,0 +1,44 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "types.hpp"
+
+namespace loader::symbols {
+
+struct Symbol {
+    std::string name;
+
+    u64 address, size;
+};
+
+void add(const char *name, u64 address, u64 size);
+
+// Returns symbol by name (or NULL)
+const Symbol *find(const char *name);
+
+// Returns symbol containing address (or NULL)
+const Symbol *lookup(u64 address);
+
+const std::map<u64, Symbol> &getSymbols();
+
+}
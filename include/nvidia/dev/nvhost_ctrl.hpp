@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <array>
+
 #include "ipc.hpp"
 #include "types.hpp"
 
@@ -25,6 +27,20 @@ namespace nvidia::dev::nvhost_ctrl {
 
 using hle::IPCContext;
 
+constexpr u32 MAX_EVENTS = 0x40;
+
+struct SyncpointEvent {
+    u32 syncptID;
+
+    bool isAllocated;
+};
+
+using State = std::array<SyncpointEvent, MAX_EVENTS>;
+
 i32 ioctl(u32 iocode, IPCContext &ctx);
 
+// Syncpoint events, saved by snapshots
+void getState(State &state);
+void setState(const State &state);
+
 }
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "ipc.hpp"
 #include "types.hpp"
 
@@ -25,9 +27,19 @@ namespace nvidia::dev::nvmap {
 
 using hle::IPCContext;
 
+struct NVMAP {
+    u64 address, size;
+};
+
+using State = std::vector<NVMAP>;
+
 i32 ioctl(u32 iocode, IPCContext &ctx);
 
 u64 getAddressFromID(u32 nvmapID, bool isHandle = false);
 u64 getSizeFromID(u32 nvmapID, bool isHandle = false);
 
+// nvmap objects, saved by snapshots
+void getState(State &state);
+void setState(const State &state);
+
 }
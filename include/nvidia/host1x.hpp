@@ -18,15 +18,26 @@
 
 #pragma once
 
+#include <array>
+
 #include "nvfence.hpp"
 #include "types.hpp"
 
 namespace nvidia::host1x {
 
+// Value taken from Yuzu
+constexpr u32 MAX_SYNCPOINTS = 192;
+
 constexpr u32 NO_SYNCPOINT = -1;
 
+using State = std::array<NVFence, MAX_SYNCPOINTS>;
+
 void init();
 
 NVFence makeFence();
 
+// Syncpoints, saved by snapshots
+void getState(State &state);
+void setState(const State &state);
+
 }
@@ -0,0 +1,43 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "types.hpp"
+
+// Guest physical memory, backs all guest memory that isn't shared with other objects
+namespace sys::memory::arena {
+
+void init();
+
+// Returns zeroed, page-aligned memory (or NULL)
+void *allocate(u64 size);
+void free(void *mem, u64 size);
+
+// Arena memory can be mapped elsewhere through the arena file descriptor
+int getFD();
+u64 getOffset(const void *mem);
+
+bool contains(const void *mem);
+
+u64 getUsedSize();
+
+// Host memory actually backing the arena
+u64 getResidentSize();
+
+}
@@ -0,0 +1,60 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "types.hpp"
+
+namespace sys::config {
+
+namespace JITProfile {
+    enum : u32 {
+        Accurate,
+        Balanced,
+        Fast,
+    };
+}
+
+// Parses command line arguments, returns false on invalid arguments
+bool init(int argc, char **argv);
+
+const char *getExecutablePath();
+
+bool useHostMappedMemory();
+bool useHostClock();
+
+// Target emulation speed in percent, 0 = unthrottled
+u32 getSpeedLimit();
+
+u32 getJITProfile();
+
+// JIT code cache size in bytes, 0 = profile default
+u32 getCodeCacheSize();
+
+// Frame to take a snapshot at (NO_SNAPSHOT_FRAME = never)
+constexpr u64 NO_SNAPSHOT_FRAME = ~0ULL;
+
+u64 getSnapshotFrame();
+
+// Guest profiler output path (or NULL)
+const char *getProfilerPath();
+
+// Frames between memory statistics dumps, 0 = only on exit
+u64 getMemoryStatsInterval();
+
+}
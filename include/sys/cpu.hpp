@@ -26,17 +26,30 @@ using hle::KThread;
 namespace sys::cpu {
 
 constexpr u64 CPU_CLOCK = 1020000000;
+constexpr u64 CNTFRQ = 19200000; // System counter frequency
+
+constexpr int CORE_NUM = 4;
 
 void init();
 
+// Selects the core driven by the calling host thread
+int getCoreID();
+void setCoreID(int coreID);
+
 void run(u64 ticks);
 void halt();
 
+void invalidateCacheRange(u64 address, u64 size);
+
+// Returns the host memory reserved for translated code, pages are only resident once code is emitted
+u64 getCodeCacheSize();
+
 void addTicks(u64 ticks);
 
 u64 getSystemTicks();
 
 u64 get(int idx);
+u64 getPC();
 u64 getTLSAddr();
 
 void set(int idx, u64 data);
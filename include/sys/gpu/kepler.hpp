@@ -18,10 +18,20 @@
 
 #pragma once
 
+#include <array>
+
 #include "types.hpp"
 
 namespace sys::gpu::kepler {
 
+constexpr u32 NUM_REGS = 0x1000;
+
+using State = std::array<u32, NUM_REGS>;
+
 void write(u32 addr, u32 data);
 
+// Register file, saved by snapshots
+void getState(State &state);
+void setState(const State &state);
+
 }
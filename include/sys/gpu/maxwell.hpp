@@ -18,11 +18,25 @@
 
 #pragma once
 
+#include <array>
+
 #include "types.hpp"
 
 namespace sys::gpu::maxwell {
 
+constexpr u32 NUM_REGS = 0x1000;
+constexpr u32 NUM_DMA_REGS = 0x800;
+
+struct State {
+    std::array<u32, NUM_REGS> regs;
+    std::array<u32, NUM_DMA_REGS> dmaRegs;
+};
+
 void write(u32 addr, u32 data);
 void writeDMA(u32 addr, u32 data);
 
+// Register files, saved by snapshots
+void getState(State &state);
+void setState(const State &state);
+
 }
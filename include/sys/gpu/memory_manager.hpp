@@ -24,17 +24,25 @@ namespace sys::gpu::memory_manager {
 
 constexpr u64 GPU_ADDRESS_SPACE = 1LLU << 40;
 
-void *getPage(u64 iova);
+// Each engine caches its own translations (only PFIFO reads GPU memory so far)
+namespace Engine {
+    enum : u32 {
+        PFIFO,
+        NumEngines,
+    };
+}
+
+void *getPage(u64 iova, u32 engine);
 
-u8 read8(u64 iova);
-u16 read16(u64 iova);
-u32 read32(u64 iova);
-u64 read64(u64 iova);
+u8 read8(u64 iova, u32 engine);
+u16 read16(u64 iova, u32 engine);
+u32 read32(u64 iova, u32 engine);
+u64 read64(u64 iova, u32 engine);
 
-void write8(u64 iova, u8 data);
-void write16(u64 iova, u16 data);
-void write32(u64 iova, u32 data);
-void write64(u64 iova, u64 data);
+void write8(u64 iova, u8 data, u32 engine);
+void write16(u64 iova, u16 data, u32 engine);
+void write32(u64 iova, u32 data, u32 engine);
+void write64(u64 iova, u64 data, u32 engine);
 
 u64 findFreeIOVA(u64 size);
 
@@ -18,6 +18,12 @@
 
 #pragma once
 
+#include <cstring>
+#include <map>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include "types.hpp"
 
 namespace sys::memory {
@@ -26,6 +32,8 @@ constexpr u64 PAGE_SHIFT = 12;
 constexpr u64 PAGE_SIZE = 1ULL << PAGE_SHIFT;
 constexpr u64 PAGE_MASK = PAGE_SIZE - 1;
 
+constexpr u64 HUGE_PAGE_SIZE = 1ULL << 21;
+
 constexpr u64 TOTAL_MEMORY_SIZE = 1LLU << 32;
 
 namespace MemoryBase {
@@ -54,6 +62,20 @@ namespace MemoryPermission {
     };
 }
 
+namespace MemoryType {
+    enum : u32 {
+        Free = 0,
+        Static = 0x02,
+        Code,
+        CodeData,
+        Normal,
+        Shared,
+        Stack = 0x0B,
+        ThreadLocal,
+        Inaccessible = 0x10,
+    };
+}
+
 namespace MemoryAttribute {
     enum : u32 {
         Locked = 1 << 0,
@@ -71,6 +93,8 @@ struct MemoryBlock {
     u32 permission;
 
     void *mem;
+
+    bool isAlias = false; // Backing memory belongs to another block (or object)
 };
 
 inline bool isAligned(u64 n) {
@@ -78,9 +102,7 @@ inline bool isAligned(u64 n) {
 }
 
 inline bool isAlignedHeap(u64 n) {
-    constexpr u64 HEAP_PAGE_MASK = 0x200000 - 1;
-
-    return (n & HEAP_PAGE_MASK) == 0;
+    return (n & (HUGE_PAGE_SIZE - 1)) == 0;
 }
 
 
@@ -110,28 +132,123 @@ u64 getHeapSize();
 u64 getUsedMemorySize();
 
 void setAppSize(u64 size);
-void setHeapSize(u64 size);
+// Returns false if the heap can't shrink because part of it is locked (i.e. mirrored)
+bool setHeapSize(u64 size);
+
+// Used by the inline accessors below, don't touch these directly
+extern u8 **readTable;
+extern u8 **writeTable;
+extern u8 *hostBase;
+extern std::vector<bool> codePages;
+
+template<typename T>
+[[gnu::cold, gnu::noinline]] T readSlow(u64 vaddr);
+
+template<typename T>
+[[gnu::cold, gnu::noinline]] void writeSlow(u64 vaddr, T data);
+
+// Returns true if an access stays within one page of the address space
+template<typename T>
+inline bool isFastAccess(u64 vaddr) {
+    return (vaddr < MemoryBase::AddressSpace) && ((vaddr & PAGE_MASK) <= (PAGE_SIZE - sizeof(T)));
+}
+
+template<typename T>
+inline T read(u64 vaddr) {
+    static_assert(std::is_unsigned_v<T>);
+
+    if (isFastAccess<T>(vaddr)) {
+        // Faults are caught by the SIGSEGV handler
+        const u8 *mem = (hostBase != NULL) ? &hostBase[vaddr & ~PAGE_MASK] : readTable[vaddr >> PAGE_SHIFT];
+
+        if (mem != NULL) {
+            T data;
+            std::memcpy(&data, &mem[vaddr & PAGE_MASK], sizeof(T));
+
+            return data;
+        }
+    }
+
+    return readSlow<T>(vaddr);
+}
 
-u8 read8(u64 vaddr);
-u16 read16(u64 vaddr);
-u32 read32(u64 vaddr);
-u64 read64(u64 vaddr);
+template<typename T>
+inline void write(u64 vaddr, T data) {
+    static_assert(std::is_unsigned_v<T>);
 
-void write8(u64 vaddr, u8 data);
-void write16(u64 vaddr, u16 data);
-void write32(u64 vaddr, u32 data);
-void write64(u64 vaddr, u64 data);
+    if (isFastAccess<T>(vaddr)) {
+        u8 *mem;
+
+        // Stores to code pages have to invalidate translated code
+        if (hostBase != NULL) {
+            mem = !codePages[vaddr >> PAGE_SHIFT] ? &hostBase[vaddr & ~PAGE_MASK] : NULL;
+        } else {
+            mem = writeTable[vaddr >> PAGE_SHIFT];
+        }
+
+        if (mem != NULL) {
+            std::memcpy(&mem[vaddr & PAGE_MASK], &data, sizeof(T));
+
+            return;
+        }
+    }
+
+    writeSlow<T>(vaddr, data);
+}
 
 void *getPointer(u64 vaddr);
+void *getWritePointer(u64 vaddr);
+const void *getReadPointer(u64 vaddr);
+
+u8 *getSpan(u64 vaddr, u64 size, bool isWrite, u64 &spanSize);
+
+// Calls func(mem, spanSize) for every host-contiguous run of a guest range
+template<typename Func>
+void forEachSpan(u64 vaddr, u64 size, bool isWrite, Func func) {
+    while (size != 0) {
+        u64 spanSize;
+        u8 *mem = getSpan(vaddr, size, isWrite, spanSize);
+
+        func(mem, spanSize);
+
+        vaddr += spanSize;
+        size -= spanSize;
+    }
+}
+
+void readBlock(u64 vaddr, void *data, u64 size);
+void writeBlock(u64 vaddr, const void *data, u64 size);
+void copyBlock(u64 dst, u64 src, u64 size);
+void fill(u64 vaddr, u8 data, u64 size);
+
+u8 *getHostBase();
+
+void **getPageTable();
 
 void map(void *mem, u64 address, u64 pageNum, u32 type, u32 attribute, u32 permission);
-void remap(u64 srcAddress, u64 dstAddress, u64 pageNum);
+void mirror(u64 srcAddress, u64 dstAddress, u64 pageNum);
+void unmirror(u64 srcAddress, u64 dstAddress, u64 pageNum);
 void unmap(u64 address, u64 pageNum);
 
 void *allocate(u64 baseAddress, u64 pageNum, u32 type, u32 attribute, u32 permission);
 
 u64 allocateTLS();
 
+void setDirtyTracking(bool enable);
+bool isDirtyTracking();
+bool isDirty(u64 address, u64 size);
+std::vector<std::pair<u64, u64>> getDirtyRanges(u64 address, u64 size);
+void clearDirty(u64 address, u64 size);
+
+// Host memory used by page tables and page bitmaps
+u64 getPageTableSize();
+
+void setAttribute(u64 address, u64 pageNum, u32 mask, u32 value);
+
 MemoryBlock queryMemory(u64 addr);
 
+const std::map<u64, MemoryBlock> &getMemoryBlocks();
+
+bool isTracked(const MemoryBlock &memoryBlock);
+
 }
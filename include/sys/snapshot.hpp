@@ -0,0 +1,45 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "types.hpp"
+
+// In-memory save states (guest memory, threads, scheduler state, nvdrv/nvflinger objects and GPU engine registers)
+// NOTE: snapshots only live as long as the process, and can't be restored once state they don't save has changed
+namespace sys::snapshot {
+
+// Queues a snapshot/restore for the next frame boundary
+void requestTake();
+void requestRestore();
+
+// Handles queued requests, has to be called while the cores are paused
+void update(u64 frame);
+
+void take();
+bool restore();
+
+bool hasSnapshot();
+
+// Host memory held by snapshot pages
+u64 getMemorySize();
+
+// Called when state that snapshots don't save changes (GPU mappings, open files...), older snapshots can't be restored
+void invalidate(const char *reason);
+
+}
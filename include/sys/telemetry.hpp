@@ -0,0 +1,64 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "types.hpp"
+
+// Guest and host memory accounting
+namespace sys::telemetry {
+
+namespace Category {
+    enum : u32 {
+        Code,
+        Heap,
+        Stack,
+        TLS,
+        SharedMemory,
+        TransferMemory, // Views of guest memory, not counted towards the total
+        GPUMapped,
+        Other,
+        NumCategories,
+    };
+}
+
+struct MemoryStats {
+    u64 size[Category::NumCategories];
+    u64 peakSize[Category::NumCategories];
+
+    u64 guestSize; // Owned guest memory (excluding views)
+
+    // Host side
+    u64 arenaResidentSize;
+    u64 pageTableSize;
+    u64 snapshotSize;
+    u64 jitCacheSize; // Reserved, not resident
+    u64 rss, peakRSS;
+    u64 sharedRSS; // Resident guest memory, counted once per mapping
+};
+
+void add(u32 category, u64 size);
+void remove(u32 category, u64 size);
+
+MemoryStats getMemoryStats();
+
+// Dumps memory statistics every N frames (see config::getMemoryStatsInterval())
+void update(u64 frame);
+void dump();
+
+}
@@ -390,4 +390,12 @@ u32 findFreeBufferQueue() {
     exit(0);
 }
 
+void getState(State &state) {
+    state = bufferQueues;
+}
+
+void setState(const State &state) {
+    bufferQueues = state;
+}
+
 }
@@ -163,4 +163,32 @@ KPort *getPort(const char *name) {
     return NULL;
 }
 
+std::vector<KObject *> getObjects(u32 type) {
+    std::vector<KObject *> objects;
+
+    for (u32 index = FIRST_HANDLE; index < nextIndex; index++) {
+        const TableEntry &entry = handleTable[index];
+
+        if ((entry.type == type) && (entry.object != NULL)) {
+            objects.push_back(entry.object);
+        }
+    }
+
+    return objects;
+}
+
+std::vector<std::pair<Handle, KObject *>> getHandles() {
+    std::vector<std::pair<Handle, KObject *>> handles;
+
+    for (u32 index = FIRST_HANDLE; index < nextIndex; index++) {
+        const TableEntry &entry = handleTable[index];
+
+        if (entry.object != NULL) {
+            handles.emplace_back(makeHandle(index, entry.type), entry.object);
+        }
+    }
+
+    return handles;
+}
+
 }
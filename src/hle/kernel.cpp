@@ -18,6 +18,8 @@
 
 #include "kernel.hpp"
 
+#include <array>
+#include <deque>
 #include <map>
 #include <type_traits>
 #include <utility>
@@ -27,13 +29,36 @@
 
 namespace hle::kernel {
 
+using sys::cpu::CORE_NUM;
+
+// Cores use this when a thread doesn't specify a processor ID
+constexpr i32 DEFAULT_CORE = 0;
+
 Handle mainThreadHandle;
 
-KThread *activeThread;
+// Serializes HLE kernel/service code between emulated cores
+std::mutex kernelLock;
+
+std::array<KThread *, CORE_NUM> activeThreads;
+
+// Started threads on each core, the active thread is at the front
+std::array<std::deque<KThread *>, CORE_NUM> runQueues;
+
+static i32 getThreadCore(KThread *thread) {
+    const i32 processorID = thread->getProcessorID();
+
+    if ((processorID < 0) || (processorID >= CORE_NUM)) {
+        return DEFAULT_CORE;
+    }
+
+    return processorID;
+}
 
 void init() {
     table::init();
 
+    activeThreads.fill(NULL);
+
     (void)makePort("sm:");
 }
 
@@ -140,17 +165,107 @@ void startThread(Handle handle) {
     KThread *thread = (KThread *)table::get(handle);
     thread->start();
 
-    setActiveThread(thread);
+    const i32 core = getThreadCore(thread);
+
+    PLOG_DEBUG << "Starting thread " << std::hex << handle.raw << " on core " << std::dec << core;
+
+    if (core == sys::cpu::getCoreID()) {
+        // Run new thread right away
+        runQueues[core].push_front(thread);
+
+        setActiveThread(thread);
+    } else {
+        // Picked up by the other core on its next time slice
+        runQueues[core].push_back(thread);
+    }
 }
 
 void setActiveThread(KThread *thread) {
+    KThread *&activeThread = activeThreads[sys::cpu::getCoreID()];
+
     if (activeThread != NULL) {
         sys::cpu::getContext(activeThread);
     }
 
     activeThread = thread;
 
-    sys::cpu::setContext(activeThread);
+    if (activeThread != NULL) {
+        sys::cpu::setContext(activeThread);
+    }
+}
+
+KThread *getActiveThread() {
+    return activeThreads[sys::cpu::getCoreID()];
+}
+
+void setThreadCore(KThread *thread, i32 processorID) {
+    PLOG_DEBUG << "Setting thread " << std::hex << thread->getHandle().raw << " processor ID to " << std::dec << processorID;
+
+    thread->setProcessorID(processorID);
+
+    // Migrated on the next time slice
+    if (thread == getActiveThread()) {
+        sys::cpu::halt();
+    }
+}
+
+bool schedule() {
+    const std::lock_guard<std::mutex> lock(kernelLock);
+
+    const int core = sys::cpu::getCoreID();
+
+    auto &runQueue = runQueues[core];
+
+    // Move threads whose processor ID has changed
+    for (auto it = runQueue.begin(); it != runQueue.end();) {
+        KThread *thread = *it;
+
+        const i32 threadCore = getThreadCore(thread);
+
+        if (threadCore == core) {
+            it++;
+
+            continue;
+        }
+
+        if (thread == activeThreads[core]) {
+            setActiveThread(NULL);
+        }
+
+        it = runQueue.erase(it);
+
+        runQueues[threadCore].push_back(thread);
+    }
+
+    if (runQueue.empty()) {
+        return false;
+    }
+
+    // Round-robin between threads on this core
+    if ((activeThreads[core] != NULL) && (runQueue.size() > 1)) {
+        runQueue.push_back(runQueue.front());
+        runQueue.pop_front();
+    }
+
+    if (runQueue.front() != activeThreads[core]) {
+        setActiveThread(runQueue.front());
+    }
+
+    return true;
+}
+
+std::mutex &getLock() {
+    return kernelLock;
+}
+
+void getSchedulerState(SchedulerState &state) {
+    state.activeThreads = activeThreads;
+    state.runQueues = runQueues;
+}
+
+void setSchedulerState(const SchedulerState &state) {
+    activeThreads = state.activeThreads;
+    runQueues = state.runQueues;
 }
 
 void destroyServiceSession(Handle handle) {
@@ -0,0 +1,188 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "libc.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ios>
+
+#include <plog/Log.h>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "symbols.hpp"
+
+namespace hle::libc {
+
+namespace Hook {
+    enum : u32 {
+        Memcpy,
+        Memmove,
+        Memset,
+        Memcmp,
+        Strlen,
+        NumHooks,
+    };
+}
+
+constexpr const char *HOOK_NAMES[Hook::NumHooks] = {
+    "memcpy",
+    "memmove",
+    "memset",
+    "memcmp",
+    "strlen",
+};
+
+// Instructions
+constexpr u32 SVC = 0xD4000001;
+constexpr u32 RET = 0xD65F03C0;
+
+// Returns number of bytes until the next page boundary
+static u64 getPageRemainder(u64 addr) {
+    return sys::memory::PAGE_SIZE - (addr & sys::memory::PAGE_MASK);
+}
+
+static void hleMemcpy() {
+    const u64 dst = sys::cpu::get(0);
+    const u64 src = sys::cpu::get(1);
+    const u64 size = sys::cpu::get(2);
+
+    sys::memory::copyBlock(dst, src, size);
+}
+
+static void hleMemmove() {
+    const u64 dst = sys::cpu::get(0);
+    const u64 src = sys::cpu::get(1);
+    const u64 size = sys::cpu::get(2);
+
+    sys::memory::copyBlock(dst, src, size);
+}
+
+static void hleMemset() {
+    const u64 dst = sys::cpu::get(0);
+    const u8 data = (u8)sys::cpu::get(1);
+    const u64 size = sys::cpu::get(2);
+
+    sys::memory::fill(dst, data, size);
+}
+
+static void hleMemcmp() {
+    u64 a = sys::cpu::get(0);
+    u64 b = sys::cpu::get(1);
+    u64 size = sys::cpu::get(2);
+
+    while (size != 0) {
+        u64 aSize, bSize;
+
+        const u8 *aMem = sys::memory::getSpan(a, size, false, aSize);
+        const u8 *bMem = sys::memory::getSpan(b, size, false, bSize);
+
+        const u64 chunkSize = std::min(aSize, bSize);
+
+        const int result = std::memcmp(aMem, bMem, chunkSize);
+
+        if (result != 0) {
+            sys::cpu::set(0, (u64)(i64)result);
+
+            return;
+        }
+
+        a += chunkSize;
+        b += chunkSize;
+        size -= chunkSize;
+    }
+
+    sys::cpu::set(0, 0);
+}
+
+static void hleStrlen() {
+    const u64 str = sys::cpu::get(0);
+
+    u64 length = 0;
+
+    while (true) {
+        u64 chunkSize;
+
+        const u8 *mem = sys::memory::getSpan(str + length, getPageRemainder(str + length), false, chunkSize);
+        const u8 *end = (u8 *)std::memchr(mem, 0, chunkSize);
+
+        if (end != NULL) {
+            length += end - mem;
+
+            break;
+        }
+
+        length += chunkSize;
+    }
+
+    sys::cpu::set(0, length);
+}
+
+void patch() {
+    for (u32 hook = 0; hook < Hook::NumHooks; hook++) {
+        const loader::symbols::Symbol *symbol = loader::symbols::find(HOOK_NAMES[hook]);
+
+        if (symbol == NULL) {
+            continue;
+        }
+
+        // Need room for SVC + RET
+        if ((symbol->size != 0) && (symbol->size < (2 * sizeof(u32)))) {
+            PLOG_WARNING << "Function " << symbol->name << " is too small to patch";
+
+            continue;
+        }
+
+        PLOG_INFO << "Replacing " << symbol->name << " @ " << std::hex << symbol->address;
+
+        const u32 code[2] = {SVC | ((HOOK_BASE + hook) << 5), RET};
+
+        // Code pages are read-only for the guest, write through the host pointer
+        for (u64 i = 0; i < sizeof(code); i += sizeof(u32)) {
+            std::memcpy(sys::memory::getPointer(symbol->address + i), &code[i / sizeof(u32)], sizeof(u32));
+        }
+    }
+}
+
+void handleHook(u32 svc) {
+    switch (svc - HOOK_BASE) {
+        case Hook::Memcpy:
+            hleMemcpy();
+            break;
+        case Hook::Memmove:
+            hleMemmove();
+            break;
+        case Hook::Memset:
+            hleMemset();
+            break;
+        case Hook::Memcmp:
+            hleMemcmp();
+            break;
+        case Hook::Strlen:
+            hleStrlen();
+            break;
+        default:
+            PLOG_FATAL << "Unrecognized HLE hook " << std::hex << svc;
+
+            exit(0);
+    }
+}
+
+}
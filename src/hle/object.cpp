@@ -24,8 +24,10 @@
 
 #include <plog/Log.h>
 
+#include "arena.hpp"
 #include "ipc.hpp"
 #include "kernel.hpp"
+#include "telemetry.hpp"
 
 namespace hle {
 
@@ -176,9 +178,16 @@ Handle KSession::getPortHandle() {
 }
 
 KSharedMemory::KSharedMemory(u64 size) : size(size) {
-    mem = std::malloc(size);
+    // Backed by the guest memory arena so that it can be aliased into guest memory, pages are zeroed by the host
+    mem = sys::memory::arena::allocate(size);
 
-    std::memset(mem, 0, size);
+    if (mem == NULL) {
+        PLOG_FATAL << "Failed to allocate shared memory";
+
+        exit(0);
+    }
+
+    sys::telemetry::add(sys::telemetry::Category::SharedMemory, size);
 }
 
 KSharedMemory::~KSharedMemory() {}
@@ -200,7 +209,7 @@ void KSharedMemory::map(u64 address, u64 size, u32 permission) {
         exit(0);
     }
 
-    sys::memory::map(mem, address, size >> sys::memory::PAGE_SHIFT, 0, 0, permission);
+    sys::memory::map(mem, address, size >> sys::memory::PAGE_SHIFT, sys::memory::MemoryType::Shared, 0, permission);
 }
 
 void KSharedMemory::unmap(u64 address, u64 size) {
@@ -210,11 +219,13 @@ void KSharedMemory::unmap(u64 address, u64 size) {
         exit(0);
     }
 
+    sys::memory::unmap(address, size >> sys::memory::PAGE_SHIFT);
+
     if (getRefCount() == 1) { // UnmapSharedMemory deletes this object
-        std::free(mem);
-    }
+        sys::memory::arena::free(mem, this->size);
 
-    sys::memory::unmap(address, size >> sys::memory::PAGE_SHIFT);
+        sys::telemetry::remove(sys::telemetry::Category::SharedMemory, this->size);
+    }
 }
 
 KThread::KThread() : status(ThreadStatus::Dormant) {}
@@ -225,6 +236,18 @@ ThreadContext *KThread::getCtx() {
     return &ctx;
 }
 
+ThreadStatus KThread::getStatus() {
+    return status;
+}
+
+i32 KThread::getPriority() {
+    return priority;
+}
+
+i32 KThread::getProcessorID() {
+    return processorID;
+}
+
 u64 KThread::getTLSBase() {
     return ctx.tpidr;
 }
@@ -233,6 +256,10 @@ void KThread::setTLSBase(u64 tlsBase) {
     ctx.tpidr = tlsBase;
 }
 
+void KThread::setStatus(ThreadStatus status) {
+    this->status = status;
+}
+
 void KThread::setPriority(i32 priority) {
     this->priority = priority;
 }
@@ -245,9 +272,13 @@ void KThread::start() {
     status = ThreadStatus::Started;
 }
 
-KTransferMemory::KTransferMemory(u64 address, u64 size) : address(address), size(size) {}
+KTransferMemory::KTransferMemory(u64 address, u64 size) : address(address), size(size) {
+    sys::telemetry::add(sys::telemetry::Category::TransferMemory, size);
+}
 
-KTransferMemory::~KTransferMemory() {}
+KTransferMemory::~KTransferMemory() {
+    sys::telemetry::remove(sys::telemetry::Category::TransferMemory, size);
+}
 
 u64 KTransferMemory::getAddress() {
     return address;
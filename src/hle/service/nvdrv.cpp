@@ -28,6 +28,7 @@
 #include "handle.hpp"
 #include "kernel.hpp"
 #include "result.hpp"
+#include "snapshot.hpp"
 
 #include "nvhost_as_gpu.hpp"
 #include "nvhost_ctrl.hpp"
@@ -58,6 +59,8 @@ FileDescriptor open(const char *path) {
 
     files.emplace_back(NVFile(nextFD));
 
+    sys::snapshot::invalidate("nvdrv file was opened");
+
     NVFile &file = files[files.size() - 1];
 
     if (std::strcmp(path, "/dev/nvmap") == 0) {
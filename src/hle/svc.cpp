@@ -18,9 +18,11 @@
 
 #include "svc.hpp"
 
+#include <array>
 #include <cstdlib>
 #include <cstring>
 #include <ios>
+#include <mutex>
 
 #include <plog/Log.h>
 
@@ -28,6 +30,7 @@
 #include "handle.hpp"
 #include "ipc_manager.hpp"
 #include "kernel.hpp"
+#include "libc.hpp"
 #include "memory.hpp"
 #include "object.hpp"
 #include "result.hpp"
@@ -39,7 +42,8 @@ namespace SupervisorCall {
         SetHeapSize = 0x01,
         SetMemoryAttribute = 0x03,
         MapMemory,
-        QueryMemory = 0x06,
+        UnmapMemory,
+        QueryMemory,
         ExitProcess,
         CreateThread,
         StartThread,
@@ -124,8 +128,73 @@ static const char *getBreakReasonName(u32 reason) {
     }
 }
 
+// Returns true if the SVC can change which thread runs on this core
+static bool isReschedulingSVC(u32 svc) {
+    switch (svc) {
+        case SupervisorCall::ExitProcess:
+        case SupervisorCall::StartThread:
+        case SupervisorCall::SetThreadCoreMask:
+        case SupervisorCall::WaitSynchronization:
+        case SupervisorCall::WaitProcessWideKeyAtomic:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns true if guests poll the SVC in idle loops
+bool isPollingSVC(u32 svc) {
+    switch (svc) {
+        case SupervisorCall::WaitSynchronization:
+        case SupervisorCall::WaitProcessWideKeyAtomic:
+        case SupervisorCall::GetSystemTick:
+        case SupervisorCall::SendSyncRequest:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns a value identifying the outcome of a polling SVC, polls with different outcomes aren't idle
+// NOTE: has to be called right after the SVC returns
+u64 getPollingResult(u32 svc) {
+    switch (svc) {
+        case SupervisorCall::GetSystemTick:
+            // The tick count always changes
+            return 0;
+        case SupervisorCall::SendSyncRequest:
+            {
+                // Compare IPC replies
+                std::array<u64, IPC_BUFFER_SIZE / sizeof(u64)> reply;
+                sys::memory::readBlock(sys::cpu::getTLSAddr(), reply.data(), IPC_BUFFER_SIZE);
+
+                u64 hash = 0xCBF29CE484222325ULL;
+
+                for (const u64 word : reply) {
+                    hash = (hash ^ word) * 0x100000001B3ULL;
+                }
+
+                return hash;
+            }
+        default:
+            return sys::cpu::get(0);
+    }
+}
+
 void handleSVC(u32 svc) {
-    sys::cpu::halt();
+    // Patched guest routines only touch guest memory, no need to take the kernel lock
+    if (libc::isHook(svc)) {
+        libc::handleHook(svc);
+
+        return;
+    }
+
+    const std::lock_guard<std::mutex> lock(kernel::getLock());
+
+    // Everything else returns straight back into JIT code
+    if (isReschedulingSVC(svc)) {
+        sys::cpu::halt();
+    }
 
     switch (svc) {
         case SupervisorCall::SetHeapSize:
@@ -137,6 +206,9 @@ void handleSVC(u32 svc) {
         case SupervisorCall::MapMemory:
             svcMapMemory();
             break;
+        case SupervisorCall::UnmapMemory:
+            svcUnmapMemory();
+            break;
         case SupervisorCall::QueryMemory:
             svcQueryMemory();
             break;
@@ -212,7 +284,7 @@ void svcBreak() {
         exit(0);
     }
 
-    const u32 result = sys::memory::read32(info);
+    const u32 result = sys::memory::read<u32>(info);
 
     PLOG_ERROR << "svcBreak (reason = " << getBreakReasonName(reason) << ", module = " << getModuleName(getModule(result)) << ", description = " << getDescription(result) << ")";
 
@@ -454,7 +526,7 @@ void svcMapMemory() {
         exit(0);
     }
 
-    sys::memory::remap(srcAddress, dstAddress, size >> sys::memory::PAGE_SHIFT);
+    sys::memory::mirror(srcAddress, dstAddress, size >> sys::memory::PAGE_SHIFT);
 
     sys::cpu::set(0, KernelResult::Success);
 }
@@ -499,7 +571,7 @@ void svcOutputDebugString() {
 
     char msg[size + 1];
     std::memset(msg, 0, sizeof(msg));
-    std::memcpy(msg, sys::memory::getPointer(string), size);
+    sys::memory::readBlock(string, msg, size);
 
     PLOG_DEBUG << (const char *)msg;
 
@@ -514,14 +586,14 @@ void svcQueryMemory() {
 
     const sys::memory::MemoryBlock memoryBlock = sys::memory::queryMemory(address);
 
-    sys::memory::write64(memoryInfo, memoryBlock.baseAddress);
-    sys::memory::write64(memoryInfo + 8, sys::memory::PAGE_SIZE * memoryBlock.size);
-    sys::memory::write32(memoryInfo + 16, memoryBlock.type);
-    sys::memory::write32(memoryInfo + 20, memoryBlock.attribute);
-    sys::memory::write32(memoryInfo + 24, memoryBlock.permission);
-    sys::memory::write32(memoryInfo + 28, 0); // IpcRefCount?
-    sys::memory::write32(memoryInfo + 32, 0); // DeviceRefCount?
-    sys::memory::write32(memoryInfo + 36, 0); // Padding
+    sys::memory::write<u64>(memoryInfo, memoryBlock.baseAddress);
+    sys::memory::write<u64>(memoryInfo + 8, sys::memory::PAGE_SIZE * memoryBlock.size);
+    sys::memory::write<u32>(memoryInfo + 16, memoryBlock.type);
+    sys::memory::write<u32>(memoryInfo + 20, memoryBlock.attribute);
+    sys::memory::write<u32>(memoryInfo + 24, memoryBlock.permission);
+    sys::memory::write<u32>(memoryInfo + 28, 0); // IpcRefCount?
+    sys::memory::write<u32>(memoryInfo + 32, 0); // DeviceRefCount?
+    sys::memory::write<u32>(memoryInfo + 36, 0); // Padding
 
     sys::cpu::set(0, KernelResult::Success);
     sys::cpu::set(1, 0); // Page info?
@@ -556,7 +628,11 @@ void svcSetHeapSize() {
         exit(0);
     }
 
-    sys::memory::setHeapSize(size);
+    if (!sys::memory::setHeapSize(size)) {
+        sys::cpu::set(0, KernelResult::InvalidCurrentMemory);
+
+        return;
+    }
 
     sys::cpu::set(0, KernelResult::Success);
     sys::cpu::set(1, sys::memory::MemoryBase::Heap);
@@ -568,7 +644,15 @@ void svcSetMemoryAttribute() {
     const u32 mask = (u32)sys::cpu::get(2);
     const u32 value = (u32)sys::cpu::get(3);
 
-    PLOG_INFO << "svcSetMemoryAttribute (address = " << std::hex << address << ", size = " << size << ", mask = " << mask << ", value = " << value << ") (stubbed)";
+    PLOG_INFO << "svcSetMemoryAttribute (address = " << std::hex << address << ", size = " << size << ", mask = " << mask << ", value = " << value << ")";
+
+    if (!sys::memory::isAligned(address) || !sys::memory::isAligned(size)) {
+        PLOG_FATAL << "Unaligned memory address/size";
+
+        exit(0);
+    }
+
+    sys::memory::setAttribute(address, size >> sys::memory::PAGE_SHIFT, mask, value);
 
     sys::cpu::set(0, KernelResult::Success);
 }
@@ -580,6 +664,28 @@ void svcSetThreadCoreMask() {
 
     PLOG_INFO << "svcSetThreadCoreMask (handle = " << std::hex << handle.raw << ", core mask 0 = " << std::dec << coreMask0 << ", core mask 1 = " << coreMask1 << ")";
 
+    KThread *thread;
+    if (handle.raw == KernelHandles::CurrentThread) {
+        thread = kernel::getActiveThread();
+    } else {
+        if (handle.type != HandleType::KThread) {
+            PLOG_FATAL << "Invalid handle type";
+
+            exit(0);
+        }
+
+        thread = (KThread *)kernel::getObject(handle);
+    }
+
+    // Core mask 0 is the ideal core, negative values keep the current one
+    if ((coreMask0 >= 0) && (coreMask0 < sys::cpu::CORE_NUM)) {
+        if ((coreMask1 & (1ULL << coreMask0)) == 0) {
+            PLOG_WARNING << "Ideal core is not part of the affinity mask";
+        }
+
+        kernel::setThreadCore(thread, coreMask0);
+    }
+
     sys::cpu::set(0, KernelResult::Success);
 }
 
@@ -603,6 +709,24 @@ void svcStartThread() {
     kernel::startThread(handle);
 }
 
+void svcUnmapMemory() {
+    const u64 dstAddress = sys::cpu::get(0);
+    const u64 srcAddress = sys::cpu::get(1);
+    const u64 size = sys::cpu::get(2);
+
+    PLOG_INFO << "svcUnmapMemory (source address = " << std::hex << srcAddress << ", destination address = " << dstAddress << ", size = " << size << ")";
+
+    if (!sys::memory::isAligned(dstAddress) || !sys::memory::isAligned(srcAddress) || !sys::memory::isAligned(size)) {
+        PLOG_FATAL << "Unaligned memory address/size";
+
+        exit(0);
+    }
+
+    sys::memory::unmirror(srcAddress, dstAddress, size >> sys::memory::PAGE_SHIFT);
+
+    sys::cpu::set(0, KernelResult::Success);
+}
+
 void svcUnmapSharedMemory() {
     Handle handle = hle::makeHandle((u32)sys::cpu::get(0));
     const u64 address = sys::cpu::get(1);
@@ -655,7 +779,7 @@ void svcWaitSynchronization() {
     }
 
     for (i32 i = 0; i < handlesNum; i++) {
-        PLOG_DEBUG << "Waiting on object with handle " << std::hex << sys::memory::read32(handles + 4 * i);
+        PLOG_DEBUG << "Waiting on object with handle " << std::hex << sys::memory::read<u32>(handles + 4 * i);
     }
 
     PLOG_WARNING << "Unimplemented WaitSynchronization";
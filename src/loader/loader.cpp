@@ -25,6 +25,7 @@
 #include <plog/Log.h>
 
 #include "cpu.hpp"
+#include "libc.hpp"
 #include "memory.hpp"
 #include "nro.hpp"
 
@@ -49,6 +50,8 @@ void load(const char *path) {
         nro::load(file);
         nro::makeHomebrewEnv();
 
+        hle::libc::patch();
+
         const char *name = std::strrchr(path, '/');
 
         char nroPath[nro::ARGV0_MAX_SIZE];
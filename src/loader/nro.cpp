@@ -18,6 +18,7 @@
 
 #include "nro.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
@@ -25,6 +26,7 @@
 
 #include "kernel.hpp"
 #include "memory.hpp"
+#include "symbols.hpp"
 
 namespace loader::nro {
 
@@ -80,6 +82,9 @@ struct EnvContextEntry {
     u64 value[2];
 } __attribute__((packed));
 
+// Host pointer to the homebrew environment page
+u8 *homebrewEnv = NULL;
+
 // Dummy list of entries for NRO/homebrew
 EnvContextEntry envContextTable[] = {
     EnvContextEntry{.key = EnvContextKey::MainThreadHandle, .flags = 1, .value{0, 0}}, // Main thread handle = 1
@@ -88,6 +93,36 @@ EnvContextEntry envContextTable[] = {
     EnvContextEntry{.key = EnvContextKey::EndOfList, .flags = 1, .value{0, 0}},
 };
 
+struct Elf64Sym {
+    u32 name;
+    u8 info, other;
+    u16 shndx;
+    u64 value, size;
+};
+
+static_assert(sizeof(Elf64Sym) == 24);
+
+constexpr u8 STT_FUNC = 2;
+
+// Adds defined functions from .dynsym to the symbol table
+void loadSymbols(const u8 *dynsym, u64 dynsymSize, const char *dynstr, u64 dynstrSize, u64 base) {
+    for (u64 offset = 0; (offset + sizeof(Elf64Sym)) <= dynsymSize; offset += sizeof(Elf64Sym)) {
+        Elf64Sym sym;
+        std::memcpy(&sym, &dynsym[offset], sizeof(Elf64Sym));
+
+        if (((sym.info & 0xF) != STT_FUNC) || (sym.shndx == 0) || (sym.name >= dynstrSize)) {
+            continue;
+        }
+
+        // Make sure the name is terminated
+        if (std::memchr(&dynstr[sym.name], 0, dynstrSize - sym.name) == NULL) {
+            continue;
+        }
+
+        symbols::add(&dynstr[sym.name], base + sym.value, sym.size);
+    }
+}
+
 void load(FILE *file) {
     // Try loading NRO header into buffer
     std::fseek(file, 0, SEEK_END);
@@ -124,7 +159,7 @@ void load(FILE *file) {
         exit(0);
     }
 
-    void *textPointer = sys::memory::allocate(applicationBase + text.offset, text.size / sys::memory::PAGE_SIZE, 0, 0, sys::memory::MemoryPermission::RX);
+    void *textPointer = sys::memory::allocate(applicationBase + text.offset, text.size / sys::memory::PAGE_SIZE, sys::memory::MemoryType::Code, 0, sys::memory::MemoryPermission::RX);
 
     if (textPointer == NULL) {
         PLOG_FATAL << "Failed to allocate memory for .text";
@@ -147,7 +182,7 @@ void load(FILE *file) {
         exit(0);
     }
 
-    void *roPointer = sys::memory::allocate(applicationBase + ro.offset, ro.size / sys::memory::PAGE_SIZE, 0, 0, sys::memory::MemoryPermission::R);
+    void *roPointer = sys::memory::allocate(applicationBase + ro.offset, ro.size / sys::memory::PAGE_SIZE, sys::memory::MemoryType::Code, 0, sys::memory::MemoryPermission::R);
 
     if (roPointer == NULL) {
         PLOG_FATAL << "Failed to allocate memory for .ro";
@@ -171,7 +206,7 @@ void load(FILE *file) {
         exit(0);
     }
 
-    void *dataPointer = sys::memory::allocate(applicationBase + data.offset, dataSize / sys::memory::PAGE_SIZE, 0, 0, sys::memory::MemoryPermission::RW);
+    void *dataPointer = sys::memory::allocate(applicationBase + data.offset, dataSize / sys::memory::PAGE_SIZE, sys::memory::MemoryType::CodeData, 0, sys::memory::MemoryPermission::RW);
 
     if (dataPointer == NULL) {
         PLOG_FATAL << "Failed to allocate memory for .data";
@@ -187,8 +222,7 @@ void load(FILE *file) {
         exit(0);
     }
 
-    // Clear .bss
-    std::memset(&((u8 *)dataPointer)[data.size], 0, bssSize);
+    // NOTE: .bss doesn't need clearing, freshly allocated guest memory is zero-filled on first touch
 
     // Check the three extra segments
     Segment apiInfo, dynstr, dynsym;
@@ -197,8 +231,19 @@ void load(FILE *file) {
     std::memcpy(&dynstr.raw, &header[HeaderOffset::DynstrSegment], HeaderFieldSize::SegmentHeader);
     std::memcpy(&dynsym.raw, &header[HeaderOffset::DynsymSegment], HeaderFieldSize::SegmentHeader);
 
-    if ((apiInfo.size != 0) || (dynstr.size != 0) || (dynsym.size != 0)) {
-        PLOG_WARNING << "Unimplemented extra segments";
+    if (apiInfo.size != 0) {
+        PLOG_WARNING << "Unimplemented .apiInfo segment";
+    }
+
+    if ((dynstr.size != 0) && (dynsym.size != 0)) {
+        if (((dynstr.offset + dynstr.size) > ro.size) || ((dynsym.offset + dynsym.size) > ro.size)) {
+            PLOG_FATAL << ".dynstr/.dynsym outside of .ro";
+
+            exit(0);
+        }
+
+        // Both segments are relative to .ro
+        loadSymbols(&((u8 *)roPointer)[dynsym.offset], dynsym.size, (const char *)&((u8 *)roPointer)[dynstr.offset], dynstr.size, applicationBase);
     }
 
     sys::memory::setAppSize(text.size + ro.size + dataSize);
@@ -220,14 +265,21 @@ void makeHomebrewEnv() {
     // "Inject" main thread handle
     envContextTable[0].value[0] = hle::kernel::getMainThreadHandle().raw;
 
-    void *homebrewEnv = sys::memory::allocate(sys::memory::MemoryBase::HomebrewEnv, 1, 0, 0, sys::memory::MemoryPermission::R);
+    homebrewEnv = (u8 *)sys::memory::allocate(sys::memory::MemoryBase::HomebrewEnv, 1, sys::memory::MemoryType::Static, 0, sys::memory::MemoryPermission::R);
     std::memcpy(homebrewEnv, envContextTable, sizeof(envContextTable));
 }
 
 void setNROPath(const char *path) {
     PLOG_DEBUG << "NRO path = " << path;
 
-    std::memcpy(sys::memory::getPointer(ARGV0_ADDR), path, std::strlen(path) + 1);
+    // The homebrew environment is read-only for the guest, write through the host pointer
+    char *argv0 = (char *)&homebrewEnv[ARGV0_ADDR - sys::memory::MemoryBase::HomebrewEnv];
+
+    const u64 size = std::min((u64)std::strlen(path), ARGV0_MAX_SIZE - 1);
+
+    std::memcpy(argv0, path, size);
+
+    argv0[size] = 0;
 }
 
 bool isNRO(FILE *file) {
@@ -0,0 +1,67 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "symbols.hpp"
+
+#include <ios>
+
+#include <plog/Log.h>
+
+namespace loader::symbols {
+
+// Symbols sorted by address
+std::map<u64, Symbol> symbolMap;
+
+void add(const char *name, u64 address, u64 size) {
+    PLOG_VERBOSE << "Adding symbol " << name << " (address = " << std::hex << address << ", size = " << size << ")";
+
+    symbolMap[address] = Symbol{.name = std::string(name), .address = address, .size = size};
+}
+
+const Symbol *find(const char *name) {
+    for (const auto &[address, symbol] : symbolMap) {
+        if (symbol.name == name) {
+            return &symbol;
+        }
+    }
+
+    return NULL;
+}
+
+const Symbol *lookup(u64 address) {
+    auto it = symbolMap.upper_bound(address);
+
+    if (it == symbolMap.begin()) {
+        return NULL;
+    }
+
+    const Symbol &symbol = (--it)->second;
+
+    // Zero-sized symbols cover everything up to the next symbol
+    if ((symbol.size != 0) && (address >= (symbol.address + symbol.size))) {
+        return NULL;
+    }
+
+    return &symbol;
+}
+
+const std::map<u64, Symbol> &getSymbols() {
+    return symbolMap;
+}
+
+}
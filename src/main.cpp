@@ -21,6 +21,7 @@
 #include <plog/Formatters/FuncMessageFormatter.h>
 #include <plog/Appenders/ColorConsoleAppender.h>
 
+#include "config.hpp"
 #include "emulator.hpp"
 
 int main(int argc, char **argv) {
@@ -28,13 +29,19 @@ int main(int argc, char **argv) {
     static plog::ColorConsoleAppender<plog::FuncMessageFormatter> consoleAppender;
     plog::init(plog::verbose, &consoleAppender);
 
-    if (argc < 2) {
+    if (!sys::config::init(argc, argv)) {
+        PLOG_FATAL << "Usage: " << argv[0] << " [--fastmem] [--clock=guest|host] [--speed=<percent>] [--turbo] [--jit=accurate|balanced|fast] [--jit-cache=<MiB>] [--snapshot-frame=<frame>] [--profile=<path>] [--memory-stats=<frames>] <executable>";
+
+        return -1;
+    }
+
+    if (sys::config::getExecutablePath() == NULL) {
         PLOG_FATAL << "Please provide a Switch executable";
 
         return -1;
     }
 
-    sys::emulator::init(argv[1]);
+    sys::emulator::init(sys::config::getExecutablePath());
     sys::emulator::run();
 
     return 0;
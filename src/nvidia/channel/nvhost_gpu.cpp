@@ -29,6 +29,7 @@
 #include "host1x.hpp"
 #include "nvfence.hpp"
 #include "nvfile.hpp"
+#include "snapshot.hpp"
 
 namespace nvidia::channel::nvhost_gpu {
 
@@ -148,6 +149,8 @@ i32 setNvmapFD(IPCContext &ctx) {
 
     PLOG_VERBOSE << "SET_NVMAP_FD (FD = " << nvmapFD << ")";
 
+    sys::snapshot::invalidate("nvmap FD was bound to the GPU channel");
+
     return NVResult::Success;
 }
 
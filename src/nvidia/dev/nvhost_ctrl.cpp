@@ -43,14 +43,6 @@ namespace IOC {
     };
 }
 
-constexpr u32 MAX_EVENTS = 0x40;
-
-struct SyncpointEvent {
-    u32 syncptID;
-
-    bool isAllocated;
-};
-
 struct SyncptWaitEventParams {
     NVFence fence;
     i32 timeout;
@@ -162,4 +154,12 @@ i32 ioctl(u32 iocode, IPCContext &ctx) {
     }
 }
 
+void getState(State &state) {
+    state = events;
+}
+
+void setState(const State &state) {
+    events = state;
+}
+
 }
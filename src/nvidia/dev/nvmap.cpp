@@ -60,10 +60,6 @@ struct GetIDParameters {
 
 static_assert(sizeof(GetIDParameters) == 8);
 
-struct NVMAP {
-    u64 address, size;
-};
-
 std::vector<NVMAP> nvmapObjects;
 
 void writeReply(void *data, size_t size, IPCContext &ctx) {
@@ -178,4 +174,12 @@ u64 getSizeFromID(u32 nvmapID, bool isHandle) {
     return nvmapObjects[nvmapID].size;
 }
 
+void getState(State &state) {
+    state = nvmapObjects;
+}
+
+void setState(const State &state) {
+    nvmapObjects = state;
+}
+
 }
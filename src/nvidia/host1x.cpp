@@ -25,9 +25,6 @@
 
 namespace nvidia::host1x {
 
-// Value taken from Yuzu
-constexpr u32 MAX_SYNCPOINTS = 192;
-
 constexpr u32 ID_OFFSET = 1024;
 
 std::array<NVFence, MAX_SYNCPOINTS> syncpoints;
@@ -66,4 +63,12 @@ NVFence makeFence() {
     return *fence;
 }
 
+void getState(State &state) {
+    state = syncpoints;
+}
+
+void setState(const State &state) {
+    syncpoints = state;
+}
+
 }
@@ -31,6 +31,7 @@
 #include "memory.hpp"
 #include "nvmap.hpp"
 #include "result.hpp"
+#include "snapshot.hpp"
 
 namespace nvidia::nvflinger {
 
@@ -89,6 +90,8 @@ u64 makeLayer(u64 displayID) {
 
     getDisplay(displayID)->makeLayer(layerID);
 
+    sys::snapshot::invalidate("nvflinger layer was created");
+
     return layerID++;
 }
 
@@ -135,7 +138,7 @@ void render(u32 nvmapID) {
     const size_t FB_SIZE = sys::emulator::SCR_WIDTH * sys::emulator::SCR_HEIGHT * sys::emulator::BPP;
 
     u8 *in = (u8 *)malloc(FB_SIZE), *out = (u8 *)malloc(FB_SIZE);
-    std::memcpy(in, sys::memory::getPointer(dev::nvmap::getAddressFromID(nvmapID)), FB_SIZE);
+    sys::memory::readBlock(dev::nvmap::getAddressFromID(nvmapID), in, FB_SIZE);
 
     convertToBlocklinear(out, in, sys::emulator::STRIDE * sys::emulator::BPP, sys::emulator::SCR_HEIGHT, 4);
     sys::emulator::update(out);
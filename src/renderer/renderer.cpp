@@ -32,6 +32,7 @@
 
 #include <plog/Log.h>
 
+#include "config.hpp"
 #include "file.hpp"
 #include "types.hpp"
 #include "window.hpp"
@@ -561,11 +562,28 @@ void makeLogicalDevice() {
     vkGetDeviceQueue(state.device, indices.presentFamily.value(), 0, &state.presentQueue);
 }
 
+VkPresentModeKHR selectPresentMode(const std::vector<VkPresentModeKHR> &presentModes) {
+    // V-Sync would throttle emulation when running at any other speed
+    if (sys::config::getSpeedLimit() == 100) {
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    for (const auto presentMode : {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR}) {
+        if (std::find(presentModes.begin(), presentModes.end(), presentMode) != presentModes.end()) {
+            return presentMode;
+        }
+    }
+
+    PLOG_WARNING << "Unable to disable V-Sync";
+
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
 void makeSwapchain() {
     const SwapchainSupportDetails details = querySwapchainSupport(state.physicalDevice);
 
     VkSurfaceFormatKHR surfaceFormat = selectSurfaceFormat(details.surfaceFormats);
-    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    VkPresentModeKHR presentMode = selectPresentMode(details.presentModes);
     VkExtent2D extent = selectExtent(details.capabilities);
 
     PLOG_VERBOSE << "Extent = [" << extent.width << ", " << extent.height << "]";
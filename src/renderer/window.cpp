@@ -18,16 +18,41 @@
 
 #include "window.hpp"
 
+#include "snapshot.hpp"
+
 namespace renderer::window {
 
 GLFWwindow *window;
 
+static void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    (void)window;
+    (void)scancode;
+    (void)mods;
+
+    if (action != GLFW_PRESS) {
+        return;
+    }
+
+    switch (key) {
+        case GLFW_KEY_F5:
+            sys::snapshot::requestTake();
+            break;
+        case GLFW_KEY_F8:
+            sys::snapshot::requestRestore();
+            break;
+        default:
+            break;
+    }
+}
+
 void init() {
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
     window = glfwCreateWindow(WIDTH, HEIGHT, "Nozomi", NULL, NULL);
+
+    glfwSetKeyCallback(window, keyCallback);
 }
 
 void deinit() {
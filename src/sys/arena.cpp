@@ -0,0 +1,245 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "arena.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ios>
+#include <iterator>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <plog/Log.h>
+
+#include "memory.hpp"
+
+namespace sys::memory::arena {
+
+// Guest physical memory lives in a memfd so that it can be mapped at several host (and guest) addresses
+int arenaFD = -1;
+
+u8 *arenaBase = NULL;
+
+// Free extents (offset, size), coalesced
+std::map<u64, u64> freeExtents;
+
+u64 usedSize = 0;
+
+static u64 alignUp(u64 n, u64 alignment) {
+    return (n + alignment - 1) & ~(alignment - 1);
+}
+
+// The arena is shmem, MADV_HUGEPAGE is ignored unless shmem_enabled is "advise", "within_size" or "always".
+// The default is "never", guest memory silently falls back to 4 KiB pages then
+static void checkHugePages() {
+    FILE *file = std::fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+
+    if (file == NULL) {
+        PLOG_WARNING << "Transparent huge pages are not available, guest memory uses 4 KiB pages";
+
+        return;
+    }
+
+    char modes[128] = {};
+
+    const bool hasModes = std::fgets(modes, sizeof(modes), file) != NULL;
+
+    std::fclose(file);
+
+    // The active mode is the one in brackets
+    if (!hasModes || (std::strstr(modes, "[never]") != NULL) || (std::strstr(modes, "[deny]") != NULL)) {
+        PLOG_WARNING << "Shmem huge pages are disabled, guest memory uses 4 KiB pages (set /sys/kernel/mm/transparent_hugepage/shmem_enabled to advise)";
+    }
+}
+
+void init() {
+    arenaFD = memfd_create("guest-memory", MFD_CLOEXEC);
+
+    if ((arenaFD < 0) || (ftruncate(arenaFD, TOTAL_MEMORY_SIZE) != 0)) {
+        PLOG_FATAL << "Failed to create guest memory arena";
+
+        exit(0);
+    }
+
+    // Reserve one extra huge page so that the arena can be aligned to huge pages
+    void *mem = mmap(NULL, TOTAL_MEMORY_SIZE + HUGE_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (mem == MAP_FAILED) {
+        PLOG_FATAL << "Failed to reserve guest memory arena";
+
+        exit(0);
+    }
+
+    arenaBase = (u8 *)alignUp((u64)mem, HUGE_PAGE_SIZE);
+
+    if (mmap(arenaBase, TOTAL_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | MAP_NORESERVE, arenaFD, 0) == MAP_FAILED) {
+        PLOG_FATAL << "Failed to map guest memory arena";
+
+        exit(0);
+    }
+
+    checkHugePages();
+
+    freeExtents.clear();
+    freeExtents.emplace(0, TOTAL_MEMORY_SIZE);
+
+    usedSize = 0;
+}
+
+// Takes [offset, offset + size) out of a free extent
+static void takeExtent(std::map<u64, u64>::iterator it, u64 offset, u64 size) {
+    const u64 extentOffset = it->first;
+    const u64 extentEnd = it->first + it->second;
+
+    freeExtents.erase(it);
+
+    if (offset > extentOffset) {
+        freeExtents.emplace(extentOffset, offset - extentOffset);
+    }
+
+    if ((offset + size) < extentEnd) {
+        freeExtents.emplace(offset + size, extentEnd - (offset + size));
+    }
+}
+
+void *allocate(u64 size) {
+    if ((size == 0) || !isAligned(size)) {
+        PLOG_ERROR << "Invalid arena allocation size " << std::hex << size;
+
+        return NULL;
+    }
+
+    const bool isHuge = isAlignedHeap(size);
+
+    u64 offset = TOTAL_MEMORY_SIZE;
+
+    if (isHuge) {
+        // Huge page regions are placed bottom-up, on huge page boundaries
+        for (auto it = freeExtents.begin(); it != freeExtents.end(); it++) {
+            const u64 alignedOffset = alignUp(it->first, HUGE_PAGE_SIZE);
+
+            if ((alignedOffset + size) <= (it->first + it->second)) {
+                offset = alignedOffset;
+
+                takeExtent(it, offset, size);
+                break;
+            }
+        }
+    } else {
+        // Small regions are placed top-down to keep them from fragmenting huge page regions
+        for (auto it = freeExtents.rbegin(); it != freeExtents.rend(); it++) {
+            if (it->second >= size) {
+                offset = it->first + it->second - size;
+
+                takeExtent(std::next(it).base(), offset, size);
+                break;
+            }
+        }
+    }
+
+    if (offset == TOTAL_MEMORY_SIZE) {
+        PLOG_ERROR << "Guest memory arena is exhausted (size = " << std::hex << size << ")";
+
+        return NULL;
+    }
+
+    u8 *mem = &arenaBase[offset];
+
+    // Transparent huge pages are only a hint (see checkHugePages), the allocation still works without them
+    if (isHuge && (madvise(mem, size, MADV_HUGEPAGE) != 0)) {
+        PLOG_WARNING << "Failed to enable huge pages for arena region " << std::hex << offset;
+    }
+
+    usedSize += size;
+
+    return (void *)mem;
+}
+
+void free(void *mem, u64 size) {
+    const u64 offset = (u64)((u8 *)mem - arenaBase);
+
+    if (((u8 *)mem < arenaBase) || ((offset + size) > TOTAL_MEMORY_SIZE)) {
+        PLOG_FATAL << "Freeing memory outside of the guest memory arena";
+
+        exit(0);
+    }
+
+    // Drop host pages (in every mapping of the range), it reads back as zeroes when it is reused
+    if (fallocate(arenaFD, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size) != 0) {
+        PLOG_WARNING << "Failed to release arena region " << std::hex << offset;
+
+        std::memset(mem, 0, size);
+    }
+
+    auto it = freeExtents.emplace(offset, size).first;
+
+    // Coalesce with neighbouring extents
+    auto next = std::next(it);
+
+    if ((next != freeExtents.end()) && ((it->first + it->second) == next->first)) {
+        it->second += next->second;
+
+        freeExtents.erase(next);
+    }
+
+    if (it != freeExtents.begin()) {
+        auto prev = std::prev(it);
+
+        if ((prev->first + prev->second) == it->first) {
+            prev->second += it->second;
+
+            freeExtents.erase(it);
+        }
+    }
+
+    usedSize -= size;
+}
+
+int getFD() {
+    return arenaFD;
+}
+
+u64 getOffset(const void *mem) {
+    return (u64)((const u8 *)mem - arenaBase);
+}
+
+bool contains(const void *mem) {
+    return ((const u8 *)mem >= arenaBase) && ((const u8 *)mem < &arenaBase[TOTAL_MEMORY_SIZE]);
+}
+
+u64 getUsedSize() {
+    return usedSize;
+}
+
+u64 getResidentSize() {
+    struct stat fileStat;
+
+    if (fstat(arenaFD, &fileStat) != 0) {
+        return 0;
+    }
+
+    return (u64)fileStat.st_blocks * 512;
+}
+
+}
@@ -0,0 +1,162 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#include <plog/Log.h>
+
+namespace sys::config {
+
+const char *executablePath = NULL;
+
+bool hostMappedMemory = false;
+bool hostClock = false;
+
+u32 speedLimit = 100;
+
+u32 jitProfile = JITProfile::Accurate;
+u32 codeCacheSize = 0;
+
+u64 snapshotFrame = NO_SNAPSHOT_FRAME;
+
+const char *profilerPath = NULL;
+
+u64 memoryStatsInterval = 0;
+
+bool init(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (std::strncmp(arg, "--", 2) != 0) {
+            if (executablePath != NULL) {
+                PLOG_ERROR << "More than one executable provided";
+
+                return false;
+            }
+
+            executablePath = arg;
+
+            continue;
+        }
+
+        if (std::strcmp(arg, "--fastmem") == 0) {
+            hostMappedMemory = true;
+        } else if (std::strcmp(arg, "--clock=guest") == 0) {
+            hostClock = false;
+        } else if (std::strcmp(arg, "--clock=host") == 0) {
+            hostClock = true;
+        } else if (std::strcmp(arg, "--turbo") == 0) {
+            speedLimit = 0;
+        } else if (std::strncmp(arg, "--speed=", 8) == 0) {
+            char *end;
+            const long speed = std::strtol(&arg[8], &end, 10);
+
+            if ((*end != 0) || (speed < 0) || (speed > 1000)) {
+                PLOG_ERROR << "Invalid speed limit " << &arg[8];
+
+                return false;
+            }
+
+            speedLimit = speed;
+        } else if (std::strcmp(arg, "--jit=accurate") == 0) {
+            jitProfile = JITProfile::Accurate;
+        } else if (std::strcmp(arg, "--jit=balanced") == 0) {
+            jitProfile = JITProfile::Balanced;
+        } else if (std::strcmp(arg, "--jit=fast") == 0) {
+            jitProfile = JITProfile::Fast;
+        } else if (std::strncmp(arg, "--jit-cache=", 12) == 0) {
+            char *end;
+            const long size = std::strtol(&arg[12], &end, 10);
+
+            if ((*end != 0) || (size <= 0) || (size > 2048)) {
+                PLOG_ERROR << "Invalid code cache size " << &arg[12];
+
+                return false;
+            }
+
+            codeCacheSize = (u32)size << 20;
+        } else if (std::strncmp(arg, "--snapshot-frame=", 17) == 0) {
+            char *end;
+            snapshotFrame = std::strtoull(&arg[17], &end, 10);
+
+            if ((end == &arg[17]) || (*end != 0)) {
+                PLOG_ERROR << "Invalid snapshot frame " << &arg[17];
+
+                return false;
+            }
+        } else if (std::strncmp(arg, "--profile=", 10) == 0) {
+            profilerPath = &arg[10];
+        } else if (std::strncmp(arg, "--memory-stats=", 15) == 0) {
+            char *end;
+            memoryStatsInterval = std::strtoull(&arg[15], &end, 10);
+
+            if ((end == &arg[15]) || (*end != 0) || (memoryStatsInterval == 0)) {
+                PLOG_ERROR << "Invalid memory statistics interval " << &arg[15];
+
+                return false;
+            }
+        } else {
+            PLOG_ERROR << "Unrecognized option " << arg;
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const char *getExecutablePath() {
+    return executablePath;
+}
+
+bool useHostMappedMemory() {
+    return hostMappedMemory;
+}
+
+bool useHostClock() {
+    return hostClock;
+}
+
+u32 getSpeedLimit() {
+    return speedLimit;
+}
+
+u32 getJITProfile() {
+    return jitProfile;
+}
+
+u32 getCodeCacheSize() {
+    return codeCacheSize;
+}
+
+u64 getSnapshotFrame() {
+    return snapshotFrame;
+}
+
+const char *getProfilerPath() {
+    return profilerPath;
+}
+
+u64 getMemoryStatsInterval() {
+    return memoryStatsInterval;
+}
+
+}
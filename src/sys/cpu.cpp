@@ -18,6 +18,8 @@
 
 #include "cpu.hpp"
 
+#include <array>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <ios>
@@ -28,16 +30,117 @@
 
 #include <plog/Log.h>
 
+#include "config.hpp"
 #include "memory.hpp"
+#include "profiler.hpp"
 #include "svc.hpp"
 
 namespace sys::cpu {
 
+constexpr u64 ADDRESS_SPACE_BITS = 36;
+
+constexpr u32 FAST_CODE_CACHE_SIZE = 256 << 20;
+
+// Idle loop detection
+constexpr int IDLE_MAX_PERIOD = 4;       // Longest repeating SVC pattern we look for
+constexpr u64 IDLE_REPEAT_THRESHOLD = 64; // Number of repeated SVCs before a loop is considered idle
+constexpr u64 IDLE_MAX_LOOP_TICKS = 256;  // Loops doing more work than this between SVCs aren't idle
+
+static_assert((1ULL << ADDRESS_SPACE_BITS) == memory::MemoryBase::AddressSpace);
+
+template<typename T>
+static bool compareAndSwap(u64 vaddr, T value, T expected) {
+    if ((vaddr & (sizeof(T) - 1)) != 0) {
+        PLOG_FATAL << "Unaligned exclusive write (addr = " << std::hex << vaddr << ")";
+
+        exit(0);
+    }
+
+    T *mem = (T *)memory::getWritePointer(vaddr);
+
+    if (mem == NULL) {
+        PLOG_FATAL << "Exclusive write to unwritable memory (addr = " << std::hex << vaddr << ")";
+
+        exit(0);
+    }
+
+    return __atomic_compare_exchange_n(mem, &expected, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Guest cycles elapsed before the current frame
+u64 frameTicks = 0;
+
+std::chrono::steady_clock::time_point startTime;
+
+bool hostClock = false;
+
+// Converts guest cycles or host time to 19.2 MHz counter ticks
+static u64 getCounter(u64 cycles) {
+    if (hostClock) {
+        const u64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+
+        return (u64)(((unsigned __int128)ns * CNTFRQ) / 1000000000ULL);
+    }
+
+    return (u64)(((unsigned __int128)cycles * CNTFRQ) / CPU_CLOCK);
+}
+
 class MyEnvironment final : public Dynarmic::A64::UserCallbacks {
+    // Recently called polling SVCs (PC, SVC number and outcome)
+    std::array<u64, IDLE_MAX_PERIOD> svcHistory;
+
+    u64 svcCount = 0;
+    u64 repeatCount = 0;
+    u64 lastSVCTicks = 0;
+
+    // Checks if the guest is spinning on the same sequence of polling SVCs with the same outcome
+    bool isIdle(u64 pc, u32 swi) {
+        if (!hle::svc::isPollingSVC(swi)) {
+            repeatCount = 0;
+
+            return false;
+        }
+
+        const u64 signature = (((pc << 8) | (u64)(u8)swi) * 0x9E3779B97F4A7C15ULL) ^ hle::svc::getPollingResult(swi);
+
+        bool isRepeat = (totalTicks - lastSVCTicks) <= IDLE_MAX_LOOP_TICKS;
+
+        if (isRepeat) {
+            isRepeat = false;
+
+            for (u64 period = 1; (period <= IDLE_MAX_PERIOD) && (period <= svcCount); period++) {
+                if (svcHistory[(svcCount - period) % IDLE_MAX_PERIOD] == signature) {
+                    isRepeat = true;
+                    break;
+                }
+            }
+        }
+
+        repeatCount = isRepeat ? repeatCount + 1 : 0;
+
+        svcHistory[svcCount++ % IDLE_MAX_PERIOD] = signature;
+        lastSVCTicks = totalTicks;
+
+        return repeatCount >= IDLE_REPEAT_THRESHOLD;
+    }
+
 public:
+    Dynarmic::A64::Jit *jit;
+
     u64 ticksLeft = 0;
+    u64 sliceTicks = 0;
     u64 totalTicks = 0;
 
+    // Starts a new time slice
+    void setTicks(u64 ticks) {
+        ticksLeft = ticks;
+        sliceTicks = ticks;
+
+        svcCount = 0;
+        repeatCount = 0;
+        lastSVCTicks = totalTicks;
+    }
+
     u64 getCyclesForInstruction(bool isThumb, u32 instruction) {
         (void)isThumb;
         (void)instruction;
@@ -50,60 +153,55 @@ public:
     }
 
     u8 MemoryRead8(Dynarmic::VAddr vaddr) override {
-        return memory::read8(vaddr);
+        return memory::read<u8>(vaddr);
     }
 
     u16 MemoryRead16(Dynarmic::VAddr vaddr) override {
-        return memory::read16(vaddr);
+        return memory::read<u16>(vaddr);
     }
 
     u32 MemoryRead32(Dynarmic::VAddr vaddr) override {
-        return memory::read32(vaddr);
+        return memory::read<u32>(vaddr);
     }
 
     u64 MemoryRead64(Dynarmic::VAddr vaddr) override {
-        return memory::read64(vaddr);
+        return memory::read<u64>(vaddr);
     }
     
     Dynarmic::A64::Vector MemoryRead128(Dynarmic::VAddr vaddr) override {
         Dynarmic::A64::Vector data;
 
-        data[0] = memory::read64(vaddr);
-        data[1] = memory::read64(vaddr + sizeof(u64));
+        data[0] = memory::read<u64>(vaddr);
+        data[1] = memory::read<u64>(vaddr + sizeof(u64));
 
         return data;
     }
 
     void MemoryWrite8(Dynarmic::VAddr vaddr, u8 value) override {
-        memory::write8(vaddr, value);
+        memory::write<u8>(vaddr, value);
     }
 
     void MemoryWrite16(Dynarmic::VAddr vaddr, u16 value) override {
-        memory::write16(vaddr, value);
+        memory::write<u16>(vaddr, value);
     }
 
     void MemoryWrite32(Dynarmic::VAddr vaddr, u32 value) override {
-        memory::write32(vaddr, value);
+        memory::write<u32>(vaddr, value);
     }
 
     void MemoryWrite64(Dynarmic::VAddr vaddr, u64 value) override {
-        memory::write64(vaddr, value);
+        memory::write<u64>(vaddr, value);
     }
 
     void MemoryWrite128(Dynarmic::VAddr vaddr, Dynarmic::A64::Vector value) override {
-        memory::write64(vaddr              , value[0]);
-        memory::write64(vaddr + sizeof(u64), value[1]);
+        memory::write<u64>(vaddr              , value[0]);
+        memory::write<u64>(vaddr + sizeof(u64), value[1]);
     }
 
-    #define makeExclusiveWriteHandler(size) \
-    bool MemoryWriteExclusive##size(u64 vaddr, u##size value, u##size expected) override { \
-        u##size current = sys::memory::read##size(vaddr); /* Get current value */          \
-        if (current == expected) {   /* Perform the write if current == expected */        \
-            sys::memory::write##size(vaddr, value);                                        \
-            return true; /* Exclusive write succeeded */                                   \
-        }                                                                                  \
-                                                                                           \
-        return false; /* Exclusive write failed */                                         \
+    // Exclusive writes are host compare-and-swaps on the backing memory
+    #define makeExclusiveWriteHandler(size)                                                             \
+    bool MemoryWriteExclusive##size(u64 vaddr, u##size value, u##size expected) override {              \
+        return compareAndSwap<u##size>(vaddr, value, expected);                                         \
     }
 
     makeExclusiveWriteHandler(8)
@@ -113,6 +211,15 @@ public:
 
     #undef makeExclusiveWriteHandler
 
+    bool MemoryWriteExclusive128(u64 vaddr, Dynarmic::A64::Vector value, Dynarmic::A64::Vector expected) override {
+        unsigned __int128 value128, expected128;
+
+        std::memcpy(&value128, value.data(), sizeof(value128));
+        std::memcpy(&expected128, expected.data(), sizeof(expected128));
+
+        return compareAndSwap<unsigned __int128>(vaddr, value128, expected128);
+    }
+
     void InterpreterFallback(u64 pc, size_t num_instructions) override {
         (void)pc;
         (void)num_instructions;
@@ -123,7 +230,24 @@ public:
     }
 
     void CallSVC(u32 swi) override {
+        // Sample PC before the SVC handler gets a chance to switch threads
+        const u64 pc = jit->GetPC();
+
+        if (profiler::isEnabled()) {
+            profiler::sample();
+        }
+
         hle::svc::handleSVC(swi);
+
+        if (isIdle(pc, swi)) {
+            PLOG_VERBOSE << "Idle loop detected (PC = " << std::hex << pc << ", SVC = " << swi << "), skipping " << std::dec << ticksLeft << " ticks";
+
+            // Fast-forward to the end of the time slice
+            totalTicks += ticksLeft;
+            ticksLeft = 0;
+
+            jit->HaltExecution();
+        }
     }
 
     void ExceptionRaised(u64 pc, Dynarmic::A64::Exception exception) override {
@@ -151,85 +275,217 @@ public:
         return ticksLeft;
     }
     
+    // Guest cycles elapsed, including the progress of the current time slice
+    u64 getCycles() {
+        return frameTicks + (sliceTicks - ticksLeft);
+    }
+
     u64 GetCNTPCT() override {
-        return totalTicks;
+        return getCounter(getCycles());
     }
 };
 
-u64 tpidr_el0 = 0;
+// Applies JIT optimizations for the selected profile
+static void setProfile(Dynarmic::A64::UserConfig &userConfig) {
+    using Dynarmic::OptimizationFlag;
+
+    // Block linking, return stack buffer, fast dispatcher and IR optimizations don't affect accuracy
+    userConfig.optimizations = Dynarmic::all_safe_optimizations;
+
+    switch (config::getJITProfile()) {
+        case config::JITProfile::Accurate:
+            break;
+        case config::JITProfile::Balanced:
+            userConfig.unsafe_optimizations = true;
+            userConfig.optimizations = userConfig.optimizations | OptimizationFlag::Unsafe_ReducedErrorFP | OptimizationFlag::Unsafe_IgnoreStandardFPCRValue;
+            break;
+        case config::JITProfile::Fast:
+            // NOTE: the global monitor is still needed with multiple cores
+            userConfig.unsafe_optimizations = true;
+            userConfig.optimizations = userConfig.optimizations | OptimizationFlag::Unsafe_UnfuseFMA | OptimizationFlag::Unsafe_ReducedErrorFP
+                                     | OptimizationFlag::Unsafe_InaccurateNaN | OptimizationFlag::Unsafe_IgnoreStandardFPCRValue;
+            userConfig.code_cache_size = FAST_CODE_CACHE_SIZE;
+            break;
+        default:
+            PLOG_FATAL << "Invalid JIT profile";
+
+            exit(0);
+    }
+
+    if (config::getCodeCacheSize() != 0) {
+        userConfig.code_cache_size = config::getCodeCacheSize();
+    }
+}
+
+struct Core {
+    MyEnvironment env;
+
+    Dynarmic::A64::Jit *jit;
+
+    u64 tpidr_el0;
+};
+
+std::array<Core, CORE_NUM> cores;
 
-Dynarmic::A64::Jit *jit;
 Dynarmic::ExclusiveMonitor *exclusiveMonitor;
 
-MyEnvironment env;
+// Host memory reserved for translated code (all cores)
+u64 codeCacheSize = 0;
+
+// Core driven by the current host thread
+thread_local int currentCoreID = 0;
 
 void init() {
-    exclusiveMonitor = new Dynarmic::ExclusiveMonitor(1);
+    exclusiveMonitor = new Dynarmic::ExclusiveMonitor(CORE_NUM);
 
-    Dynarmic::A64::UserConfig config;
+    frameTicks = 0;
+    startTime = std::chrono::steady_clock::now();
+    hostClock = config::useHostClock();
 
-    config.callbacks = &env;
-    config.define_unpredictable_behaviour = true;
-    config.global_monitor = exclusiveMonitor;
-    config.processor_id = 0;
+    PLOG_INFO << "System counter derived from " << (hostClock ? "host clock" : "guest cycles");
 
-    config.tpidr_el0 = &tpidr_el0;
-    config.tpidrro_el0 = &tpidr_el0;
+    constexpr const char *PROFILE_NAMES[] = {"accurate", "balanced", "fast"};
 
-    jit = new Dynarmic::A64::Jit(config);
+    PLOG_INFO << "JIT profile = " << PROFILE_NAMES[config::getJITProfile()];
 
-    env.totalTicks = 0;
+    codeCacheSize = 0;
 
-    jit->Reset();
-    jit->ClearCache();
-    jit->GetRegisters().fill(0);
-    jit->GetVectors().fill(Dynarmic::A64::Vector{});
-    
-    setTLSAddr(memory::MemoryBase::TLSBase);
+    for (int coreID = 0; coreID < CORE_NUM; coreID++) {
+        Core &core = cores[coreID];
+
+        Dynarmic::A64::UserConfig config;
+
+        config.callbacks = &core.env;
+        config.define_unpredictable_behaviour = true;
+
+        setProfile(config);
+        codeCacheSize += config.code_cache_size;
+
+        config.global_monitor = exclusiveMonitor;
+        config.processor_id = coreID;
+
+        config.tpidr_el0 = &core.tpidr_el0;
+        config.tpidrro_el0 = &core.tpidr_el0;
+
+        config.cntfrq_el0 = CNTFRQ;
+        config.wall_clock_cntpct = false;
+
+        // Let the JIT translate guest addresses inline
+        config.page_table = memory::getPageTable();
+        config.page_table_address_space_bits = ADDRESS_SPACE_BITS;
+        config.silently_mirror_page_table = false;
+
+        // Accesses crossing a page boundary have to go through the callbacks (pages aren't contiguous on the host)
+        config.detect_misaligned_access_via_page_table = 16 | 32 | 64 | 128;
+        config.only_detect_misalignment_via_page_table_on_page_boundary = true;
+
+        // Host-mapped guest memory, guest address = host base + vaddr
+        if (memory::getHostBase() != NULL) {
+            config.fastmem_pointer = memory::getHostBase();
+            config.fastmem_address_space_bits = ADDRESS_SPACE_BITS;
+            config.silently_mirror_fastmem = false;
+
+            // Emit exclusive accesses as inline host compare-and-swaps
+            config.fastmem_exclusive_access = true;
+        }
+
+        core.jit = new Dynarmic::A64::Jit(config);
+
+        core.env.jit = core.jit;
+
+        core.env.totalTicks = 0;
+
+        core.jit->Reset();
+        core.jit->ClearCache();
+        core.jit->GetRegisters().fill(0);
+        core.jit->GetVectors().fill(Dynarmic::A64::Vector{});
+
+        core.tpidr_el0 = memory::MemoryBase::TLSBase;
+    }
+}
+
+int getCoreID() {
+    return currentCoreID;
+}
+
+void setCoreID(int coreID) {
+    if ((coreID < 0) || (coreID >= CORE_NUM)) {
+        PLOG_FATAL << "Invalid core ID " << coreID;
+
+        exit(0);
+    }
+
+    currentCoreID = coreID;
 }
 
 void run(u64 ticks) {
-    env.ticksLeft = ticks;
+    Core &core = cores[currentCoreID];
+
+    core.env.setTicks(ticks);
 
-    const auto exitReason = jit->Run();
+    const auto exitReason = core.jit->Run();
 
     if ((exitReason != Dynarmic::HaltReason::UserDefined1) && (exitReason != Dynarmic::HaltReason::CacheInvalidation)) {
-        PLOG_WARNING << "Unhandled JIT exit " << std::hex << (u32)exitReason;
+        PLOG_WARNING << "Unhandled JIT exit " << std::hex << (u32)exitReason << " on core " << std::dec << currentCoreID;
     }
 
-    jit->ClearHalt();
-    jit->ClearHalt(Dynarmic::HaltReason::CacheInvalidation);
+    core.jit->ClearHalt();
+    core.jit->ClearHalt(Dynarmic::HaltReason::CacheInvalidation);
+
+    if (profiler::isEnabled()) {
+        profiler::sample();
+    }
+}
+
+// Drops translated code in a range on all cores (deferred until a core leaves the JIT)
+void invalidateCacheRange(u64 address, u64 size) {
+    PLOG_DEBUG << "Invalidating code cache (address = " << std::hex << address << ", size = " << size << ")";
+
+    for (auto &core : cores) {
+        core.jit->InvalidateCacheRange(address, size);
+    }
+}
+
+u64 getCodeCacheSize() {
+    return codeCacheSize;
 }
 
 void halt() {
-    jit->HaltExecution();
+    cores[currentCoreID].jit->HaltExecution();
 }
 
+// Advances guest time at the end of a frame
 void addTicks(u64 ticks) {
-    env.totalTicks += ticks;
+    frameTicks += ticks;
 }
 
 u64 getSystemTicks() {
-    return env.totalTicks / 100; // Bad approximation
+    return getCounter(cores[currentCoreID].env.getCycles());
 }
 
 u64 get(int idx) {
-    return jit->GetRegister(idx);
+    return cores[currentCoreID].jit->GetRegister(idx);
+}
+
+u64 getPC() {
+    return cores[currentCoreID].jit->GetPC();
 }
 
 u64 getTLSAddr() {
-    return tpidr_el0;
+    return cores[currentCoreID].tpidr_el0;
 }
 
 void set(int idx, u64 data) {
-    jit->SetRegister(idx, data);
+    cores[currentCoreID].jit->SetRegister(idx, data);
 }
 
 void setTLSAddr(u64 addr) {
-    tpidr_el0 = addr;
+    cores[currentCoreID].tpidr_el0 = addr;
 }
 
 void getContext(KThread *thread) {
+    Dynarmic::A64::Jit *jit = cores[currentCoreID].jit;
+
     auto ctx = thread->getCtx();
 
     ctx->pc = jit->GetPC();
@@ -245,7 +501,12 @@ void getContext(KThread *thread) {
 }
 
 void setContext(KThread *thread) {
-    halt();
+    Dynarmic::A64::Jit *jit = cores[currentCoreID].jit;
+
+    // Only stop the JIT if we're switching from within an SVC, otherwise the next time slice would be skipped
+    if (jit->IsExecuting()) {
+        halt();
+    }
 
     auto ctx = thread->getCtx();
 
@@ -266,7 +527,9 @@ void setContext(KThread *thread) {
     jit->SetRegisters(regs);
     jit->SetVectors(vregs);
 
-    jit->ClearCache();
+    // Drop the monitor reservation of the previous thread
+    // NOTE: translated blocks don't depend on thread state, so the code cache is kept
+    jit->ClearExclusiveState();
 }
 
 }
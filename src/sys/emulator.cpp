@@ -18,6 +18,15 @@
 
 #include "emulator.hpp"
 
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <plog/Log.h>
+
+#include "config.hpp"
 #include "cpu.hpp"
 #include "host1x.hpp"
 #include "kernel.hpp"
@@ -26,19 +35,79 @@
 #include "nvflinger.hpp"
 #include "nvhost_gpu.hpp"
 #include "object.hpp"
+#include "profiler.hpp"
 #include "renderer.hpp"
+#include "snapshot.hpp"
+#include "telemetry.hpp"
 #include "window.hpp"
 
 namespace sys::emulator {
 
-constexpr u64 CYCLES_PER_FRAME = cpu::CPU_CLOCK / 60;
+constexpr u64 FPS = 60;
+constexpr u64 CYCLES_PER_FRAME = cpu::CPU_CLOCK / FPS;
 
 using hle::Handle;
 
+// Host threads driving the emulated cores, synchronized at frame boundaries
+std::array<std::thread, cpu::CORE_NUM> coreThreads;
+
+std::mutex frameMutex;
+std::condition_variable frameStart, frameDone;
+
+u64 frameCounter = 0;
+int coresDone = 0;
+bool quitting = false;
+
+static void runCore(int coreID) {
+    cpu::setCoreID(coreID);
+
+    u64 frame = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(frameMutex);
+
+            frameStart.wait(lock, [&] { return quitting || (frameCounter != frame); });
+
+            if (quitting) {
+                return;
+            }
+
+            frame = frameCounter;
+        }
+
+        if (hle::kernel::schedule()) {
+            cpu::run(CYCLES_PER_FRAME);
+        }
+
+        {
+            const std::lock_guard<std::mutex> lock(frameMutex);
+
+            coresDone++;
+        }
+
+        frameDone.notify_one();
+    }
+}
+
+static void runFrame() {
+    std::unique_lock<std::mutex> lock(frameMutex);
+
+    coresDone = 0;
+    frameCounter++;
+
+    frameStart.notify_all();
+
+    frameDone.wait(lock, [] { return coresDone == cpu::CORE_NUM; });
+}
+
 void init(const char *path) {
     renderer::window::init();
     renderer::init();
 
+    profiler::init(config::getProfilerPath());
+
+    memory::init();
     cpu::init();
     hle::kernel::init();
     nvidia::host1x::init();
@@ -56,18 +125,65 @@ void init(const char *path) {
     loader::load(path);
 
     // Set up stack
-    (void)memory::allocate(memory::MemoryBase::Stack, memory::STACK_PAGES, 0, 0, memory::MemoryPermission::RW);
+    (void)memory::allocate(memory::MemoryBase::Stack, memory::STACK_PAGES, memory::MemoryType::Stack, 0, memory::MemoryPermission::RW);
 }
 
 void run() {
+    for (int coreID = 0; coreID < cpu::CORE_NUM; coreID++) {
+        coreThreads[coreID] = std::thread(runCore, coreID);
+    }
+
+    const u32 speedLimit = config::getSpeedLimit();
+
+    if (speedLimit == 0) {
+        PLOG_INFO << "Running unthrottled";
+    } else {
+        PLOG_INFO << "Speed limit = " << speedLimit << "%";
+    }
+
+    auto nextFrame = std::chrono::steady_clock::now();
+
     while (!renderer::window::shouldQuit()) {
-        cpu::run(CYCLES_PER_FRAME);
+        runFrame();
+
         cpu::addTicks(CYCLES_PER_FRAME);
 
+        // Cores are paused between frames
+        snapshot::update(frameCounter);
+        telemetry::update(frameCounter);
+
         renderer::window::pollEvents();
         renderer::draw();
+
+        if (speedLimit != 0) {
+            nextFrame += std::chrono::nanoseconds(100ULL * 1000000000ULL / (FPS * speedLimit));
+
+            const auto now = std::chrono::steady_clock::now();
+
+            if (nextFrame > now) {
+                std::this_thread::sleep_until(nextFrame);
+            } else {
+                // Don't try to catch up after falling behind
+                nextFrame = now;
+            }
+        }
+    }
+
+    {
+        const std::lock_guard<std::mutex> lock(frameMutex);
+
+        quitting = true;
     }
 
+    frameStart.notify_all();
+
+    for (auto &coreThread : coreThreads) {
+        coreThread.join();
+    }
+
+    profiler::dump();
+    telemetry::dump();
+
     renderer::waitIdle();
 
     renderer::deinit();
@@ -28,8 +28,6 @@ namespace sys::gpu::compute {
 
 constexpr bool ENABLE_WRITE_LOG = true;
 
-constexpr u32 NUM_REGS = 0x1000;
-
 std::array<u32, NUM_REGS> regs;
 
 void write(u32 addr, u32 data) {
@@ -51,4 +49,12 @@ void write(u32 addr, u32 data) {
     }
 }
 
+void getState(State &state) {
+    state = regs;
+}
+
+void setState(const State &state) {
+    regs = state;
+}
+
 }
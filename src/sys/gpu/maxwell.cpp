@@ -30,9 +30,6 @@ namespace sys::gpu::maxwell {
 
 constexpr bool ENABLE_WRITE_LOG = true;
 
-constexpr u32 NUM_REGS = 0x1000;
-constexpr u32 NUM_DMA_REGS = 0x800;
-
 std::array<u32, NUM_REGS> regs;
 std::array<u32, NUM_DMA_REGS> dmaRegs;
 
@@ -829,4 +826,14 @@ void writeDMA(u32 addr, u32 data) {
     }
 }
 
+void getState(State &state) {
+    state.regs = regs;
+    state.dmaRegs = dmaRegs;
+}
+
+void setState(const State &state) {
+    regs = state.regs;
+    dmaRegs = state.dmaRegs;
+}
+
 }
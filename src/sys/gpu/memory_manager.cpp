@@ -19,155 +19,176 @@
 #include "memory_manager.hpp"
 
 #include <cstdlib>
+#include <cstring>
 #include <ios>
-#include <unordered_map>
+#include <vector>
 
 #include <plog/Log.h>
 
 #include "memory.hpp"
+#include "snapshot.hpp"
+#include "telemetry.hpp"
 
 namespace sys::gpu::memory_manager {
 
-std::unordered_map<u64, u8 *> pages;
+using sys::memory::PAGE_MASK;
+using sys::memory::PAGE_SHIFT;
+using sys::memory::PAGE_SIZE;
 
-void *getPage(u64 iova) {
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
+constexpr u64 GPU_PAGE_NUM = GPU_ADDRESS_SPACE >> PAGE_SHIFT;
 
-    if (pages.find(page) != pages.end()) {
-        return pages[page];
-    }
+// Two-level GPU page table, second level tables are allocated when pages are first mapped in their range
+constexpr u64 TABLE_SHIFT = 14;
+constexpr u64 TABLE_SIZE = 1ULL << TABLE_SHIFT;
+constexpr u64 TABLE_MASK = TABLE_SIZE - 1;
 
-    PLOG_FATAL << "Invalid GPU page " << std::hex << page;
+std::vector<std::vector<u8 *>> pageTable(GPU_PAGE_NUM >> TABLE_SHIFT);
 
-    exit(0);
-}
+// Direct-mapped translation cache
+// NOTE: only valid translations are cached, GPU pages are never unmapped
+constexpr u64 TLB_SIZE = 64;
 
-u8 read8(u64 iova) {
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
+struct TLB {
+    u64 tags[TLB_SIZE];
+    u8 *pages[TLB_SIZE];
+};
 
-    if (pages.find(page) != pages.end()) {
-        return pages[page][iova & sys::memory::PAGE_MASK];
+TLB tlbs[Engine::NumEngines];
+
+// Returns host page of a GPU page (or NULL)
+static u8 *walk(u64 page) {
+    if (page >= GPU_PAGE_NUM) {
+        return NULL;
     }
 
-    PLOG_FATAL << "Unrecognized GPU read8 (address = " << std::hex << iova << ")";
+    const std::vector<u8 *> &table = pageTable[page >> TABLE_SHIFT];
 
-    exit(0);
+    if (table.empty()) {
+        return NULL;
+    }
+
+    return table[page & TABLE_MASK];
 }
 
-u16 read16(u64 iova) {
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
+static u8 *translate(u64 iova, u32 engine) {
+    const u64 page = iova >> PAGE_SHIFT;
 
-    if (pages.find(page) != pages.end()) {
-        u16 data;
-        std::memcpy(&data, &pages[page][iova & sys::memory::PAGE_MASK], sizeof(u16));
-        
-        return data;
-    }
+    TLB &tlb = tlbs[engine];
 
-    PLOG_FATAL << "Unrecognized GPU read16 (address = " << std::hex << iova << ")";
+    const u64 index = page & (TLB_SIZE - 1);
 
-    exit(0);
-}
+    if ((tlb.pages[index] != NULL) && (tlb.tags[index] == page)) {
+        return tlb.pages[index];
+    }
 
-u32 read32(u64 iova) {
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
+    u8 *mem = walk(page);
 
-    if (pages.find(page) != pages.end()) {
-        u32 data;
-        std::memcpy(&data, &pages[page][iova & sys::memory::PAGE_MASK], sizeof(u32));
-        
-        return data;
+    if (mem != NULL) {
+        tlb.tags[index] = page;
+        tlb.pages[index] = mem;
     }
 
-    PLOG_FATAL << "Unrecognized GPU read32 (address = " << std::hex << iova << ")";
-
-    exit(0);
+    return mem;
 }
 
-u64 read64(u64 iova) {
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
+void *getPage(u64 iova, u32 engine) {
+    u8 *mem = translate(iova, engine);
 
-    if (pages.find(page) != pages.end()) {
-        u64 data;
-        std::memcpy(&data, &pages[page][iova & sys::memory::PAGE_MASK], sizeof(u64));
-        
-        return data;
+    if (mem != NULL) {
+        return mem;
     }
 
-    PLOG_FATAL << "Unrecognized GPU read64 (address = " << std::hex << iova << ")";
+    PLOG_FATAL << "Invalid GPU page " << std::hex << (iova >> PAGE_SHIFT);
 
     exit(0);
 }
 
-void write8(u64 iova, u8 data) {
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
+template<typename T>
+static T read(u64 iova, u32 engine) {
+    const u8 *mem = translate(iova, engine);
 
-    if (pages.find(page) != pages.end()) {
-        pages[page][iova & sys::memory::PAGE_MASK] = data;
+    if (mem != NULL) {
+        T data;
+        std::memcpy(&data, &mem[iova & PAGE_MASK], sizeof(T));
 
-        return;
+        return data;
     }
 
-    PLOG_FATAL << "Unrecognized GPU write8 (address = " << std::hex << iova << ", data = " << (u32)data <<  ")";
+    PLOG_FATAL << "Unrecognized GPU read" << 8 * sizeof(T) << " (address = " << std::hex << iova << ")";
 
     exit(0);
 }
 
-void write16(u64 iova, u16 data) {
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
+template<typename T>
+static void write(u64 iova, T data, u32 engine) {
+    u8 *mem = translate(iova, engine);
 
-    if (pages.find(page) != pages.end()) {
-        std::memcpy(&pages[page][iova & sys::memory::PAGE_MASK], &data, sizeof(u16));
+    if (mem != NULL) {
+        std::memcpy(&mem[iova & PAGE_MASK], &data, sizeof(T));
 
         return;
     }
 
-    PLOG_FATAL << "Unrecognized GPU write16 (address = " << std::hex << iova << ", data = " << data <<  ")";
+    PLOG_FATAL << "Unrecognized GPU write" << 8 * sizeof(T) << " (address = " << std::hex << iova << ", data = " << (u64)data << ")";
 
     exit(0);
 }
 
-void write32(u64 iova, u32 data) {
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
-
-    if (pages.find(page) != pages.end()) {
-        std::memcpy(&pages[page][iova & sys::memory::PAGE_MASK], &data, sizeof(u32));
-
-        return;
-    }
+u8 read8(u64 iova, u32 engine) {
+    return read<u8>(iova, engine);
+}
 
-    PLOG_FATAL << "Unrecognized GPU write32 (address = " << std::hex << iova << ", data = " << data <<  ")";
+u16 read16(u64 iova, u32 engine) {
+    return read<u16>(iova, engine);
+}
 
-    exit(0);
+u32 read32(u64 iova, u32 engine) {
+    return read<u32>(iova, engine);
 }
 
-void write64(u64 iova, u64 data) {
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
+u64 read64(u64 iova, u32 engine) {
+    return read<u64>(iova, engine);
+}
 
-    if (pages.find(page) != pages.end()) {
-        std::memcpy(&pages[page][iova & sys::memory::PAGE_MASK], &data, sizeof(u64));
+void write8(u64 iova, u8 data, u32 engine) {
+    write<u8>(iova, data, engine);
+}
 
-        return;
-    }
+void write16(u64 iova, u16 data, u32 engine) {
+    write<u16>(iova, data, engine);
+}
 
-    PLOG_FATAL << "Unrecognized GPU write64 (address = " << std::hex << iova << ", data = " << data <<  ")";
+void write32(u64 iova, u32 data, u32 engine) {
+    write<u32>(iova, data, engine);
+}
 
-    exit(0);
+void write64(u64 iova, u64 data, u32 engine) {
+    write<u64>(iova, data, engine);
 }
 
+// Returns the first free GPU range of the requested size
 u64 findFreeIOVA(u64 size) {
-    const u64 pageNum = size >> sys::memory::PAGE_SHIFT;
-
-    for (u64 i = 0; i < sys::memory::PAGE_NUM; i++) {
-        if (pages.find(i) == pages.end()) {
-            for (u64 j = 0; j < pageNum; j++) {
-                if (pages.find(i + j) != pages.end()) {
-                    i += j;
-                    break;
-                }
-            }
-
-            return i << sys::memory::PAGE_SHIFT;
+    const u64 pageNum = size >> PAGE_SHIFT;
+
+    u64 freePages = 0;
+
+    for (u64 page = 0; page < GPU_PAGE_NUM;) {
+        // Skip over unallocated second level tables
+        if (((page & TABLE_MASK) == 0) && pageTable[page >> TABLE_SHIFT].empty()) {
+            freePages += TABLE_SIZE;
+            page += TABLE_SIZE;
+        } else if (walk(page) == NULL) {
+            freePages++;
+            page++;
+        } else {
+            freePages = 0;
+            page++;
+
+            continue;
+        }
+
+        if (freePages >= pageNum) {
+            return (page - freePages) << PAGE_SHIFT;
         }
     }
 
@@ -179,20 +200,38 @@ u64 findFreeIOVA(u64 size) {
 void map(u64 iova, u64 address, u64 size, u64 align) {
     (void)align;
 
-    const u64 page = iova >> sys::memory::PAGE_SHIFT;
-    const u64 pageNum = size / sys::memory::PAGE_SIZE;
+    const u64 page = iova >> PAGE_SHIFT;
+    const u64 pageNum = size / PAGE_SIZE;
 
     PLOG_INFO << "Mapping " << pageNum << " pages (IOVA = " << std::hex << iova << ", address = " << address << ")";
 
+    snapshot::invalidate("GPU memory was mapped");
+
+    if ((page + pageNum) > GPU_PAGE_NUM) {
+        PLOG_FATAL << "GPU mapping out of range";
+
+        exit(0);
+    }
+
     for (u64 i = 0; i < pageNum; i++) {
-        if (pages.find(page + i) != pages.end()) {
+        std::vector<u8 *> &table = pageTable[(page + i) >> TABLE_SHIFT];
+
+        if (table.empty()) {
+            table.resize(TABLE_SIZE, NULL);
+        }
+
+        u8 *&entry = table[(page + i) & TABLE_MASK];
+
+        if (entry != NULL) {
             PLOG_FATAL << "GPU page already mapped";
 
             exit(0);
         }
 
-        pages[page + i] = (u8 *)sys::memory::getPointer(address + i * sys::memory::PAGE_SIZE);
+        entry = (u8 *)sys::memory::getPointer(address + i * PAGE_SIZE);
     }
+
+    sys::telemetry::add(sys::telemetry::Category::GPUMapped, pageNum * PAGE_SIZE);
 }
 
 }
@@ -28,6 +28,7 @@
 #include "kepler.hpp"
 #include "maxwell.hpp"
 #include "memory_manager.hpp"
+#include "snapshot.hpp"
 
 namespace sys::gpu::pfifo {
 
@@ -123,6 +124,8 @@ void bindSubchannel(u32 subchannel, u32 data) {
 
             exit(0);
     }
+
+    snapshot::invalidate("GPU subchannel was bound");
 }
 
 void submit(CommandListHeader header) {
@@ -130,7 +133,7 @@ void submit(CommandListHeader header) {
 
     for (u64 i = 0; i < header.size;) {
         Command command;
-        command.raw = memory_manager::read32(header.iova + sizeof(u32) * i++);
+        command.raw = memory_manager::read32(header.iova + sizeof(u32) * i++, memory_manager::Engine::PFIFO);
 
         PLOG_VERBOSE << "Command word = " << std::hex << command.raw << " (opcode = " << std::dec << command.opcode << ", subchannel = " << command.subchannel << ", address = " << std::hex << command.address << ")";
 
@@ -148,7 +151,7 @@ void submit(CommandListHeader header) {
 
                                 u32 address = command.address;
                                 for (u32 j = 0; j < (command.data >> 2); j++) {
-                                    const u32 data = memory_manager::read32(header.iova + sizeof(u32) * i++);
+                                    const u32 data = memory_manager::read32(header.iova + sizeof(u32) * i++, memory_manager::Engine::PFIFO);
 
                                     if (subchannels[command.subchannel] == NULL) {
                                         if (address != 0) {
@@ -177,7 +180,7 @@ void submit(CommandListHeader header) {
 
                     u32 address = command.address;
                     for (u32 j = 0; j < command.data; j++) {
-                        const u32 data = memory_manager::read32(header.iova + sizeof(u32) * i++);
+                        const u32 data = memory_manager::read32(header.iova + sizeof(u32) * i++, memory_manager::Engine::PFIFO);
 
                         if (subchannels[command.subchannel] == NULL) {
                             if (address != 0) {
@@ -199,7 +202,7 @@ void submit(CommandListHeader header) {
 
                     const u32 address = command.address;
                     for (u32 j = 0; j < command.data; j++) {
-                        const u32 data = memory_manager::read32(header.iova + sizeof(u32) * i++);
+                        const u32 data = memory_manager::read32(header.iova + sizeof(u32) * i++, memory_manager::Engine::PFIFO);
 
                         if (subchannels[command.subchannel] == NULL) {
                             if (address != 0) {
@@ -232,7 +235,7 @@ void submit(CommandListHeader header) {
 
                     u32 address = command.address;
                     for (u32 j = 0; j < command.data; j++) {
-                        const u32 data = memory_manager::read32(header.iova + sizeof(u32) * i++);
+                        const u32 data = memory_manager::read32(header.iova + sizeof(u32) * i++, memory_manager::Engine::PFIFO);
 
                         if (subchannels[command.subchannel] == NULL) {
                             if (address != 0) {
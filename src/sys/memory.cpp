@@ -18,464 +18,1305 @@
 
 #include "memory.hpp"
 
-#include <array>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ios>
-#include <list>
+#include <iterator>
+#include <map>
+#include <vector>
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <plog/Log.h>
 
-namespace sys::memory {
+#include "arena.hpp"
+#include "config.hpp"
+#include "cpu.hpp"
+#include "telemetry.hpp"
+
+namespace sys::memory {
+
+// Page tables (flat, the JIT indexes the write table directly)
+// NOTE: both tables are reserved with MAP_NORESERVE, the host only backs the parts covering mapped guest memory
+u8 **readTable = NULL;
+u8 **writeTable = NULL;
+
+// Pages holding guest code, changing these has to invalidate translated code
+std::vector<bool> codePages(PAGE_NUM, false);
+
+// Pages the guest can write to (one bit per page), lets core threads check permissions without the block record
+std::vector<u64> writablePages(PAGE_NUM / 64, 0);
+
+// Dirty page tracking (one bit per page), clean pages are write-protected so that the first store can be caught
+// NOTE: clean pages are left out of the write table (the JIT page table), in host-mapped mode they are also mprotect'd
+bool dirtyTracking = false;
+
+std::vector<u64> dirtyPages;
+std::vector<u64> protectedPages; // Host-mapped mode only
+
+// Host mapping of the entire guest address space (host-mapped mode only)
+u8 *hostBase = NULL;
+
+struct sigaction oldSegvAction;
+
+// Memory blocks by base address, free gaps included (blocks always cover the entire address space)
+std::map<u64, MemoryBlock> memoryBlockRecord;
+
+// Source ranges of mirrors (and their permissions before they were mirrored) by mirror address
+struct MirroredRange {
+    u64 address, pageNum;
+
+    u32 permission;
+};
+
+std::map<u64, std::vector<MirroredRange>> mirrorRecord;
+
+u64 appSize = 0;
+u64 heapSize = 0;
+u64 usedMemorySize = 0;
+
+static bool testBit(const std::vector<u64> &bitmap, u64 page) {
+    return (__atomic_load_n(&bitmap[page >> 6], __ATOMIC_RELAXED) & (1ULL << (page & 63))) != 0;
+}
+
+static void setBit(std::vector<u64> &bitmap, u64 page) {
+    __atomic_fetch_or(&bitmap[page >> 6], 1ULL << (page & 63), __ATOMIC_RELAXED);
+}
+
+// Returns the bits of [page, endPage) that are in the same word as page
+static u64 getWordMask(u64 page, u64 endPage) {
+    const u64 count = std::min(64 - (page & 63), endPage - page);
+
+    return ((count == 64) ? ~0ULL : ((1ULL << count) - 1)) << (page & 63);
+}
+
+// Range operations work on whole words
+static void setBits(std::vector<u64> &bitmap, u64 basePage, u64 pageNum) {
+    const u64 endPage = basePage + pageNum;
+
+    for (u64 page = basePage; page < endPage; page = (page | 63) + 1) {
+        __atomic_fetch_or(&bitmap[page >> 6], getWordMask(page, endPage), __ATOMIC_RELAXED);
+    }
+}
+
+static void clearBits(std::vector<u64> &bitmap, u64 basePage, u64 pageNum) {
+    const u64 endPage = basePage + pageNum;
+
+    for (u64 page = basePage; page < endPage; page = (page | 63) + 1) {
+        __atomic_fetch_and(&bitmap[page >> 6], ~getWordMask(page, endPage), __ATOMIC_RELAXED);
+    }
+}
+
+// Catches guest accesses to unmapped pages in host-mapped mode
+static void handleSegfault(int sig, siginfo_t *info, void *ucontext) {
+    (void)ucontext;
+
+    const u8 *addr = (u8 *)info->si_addr;
+
+    if ((addr >= hostBase) && (addr < (hostBase + MemoryBase::AddressSpace))) {
+        const u64 page = (u64)(addr - hostBase) >> PAGE_SHIFT;
+
+        // First store to a clean page, make it writable and retry
+        // NOTE: dirty pages can still fault if another thread is just unprotecting them
+        if (dirtyTracking && (testBit(protectedPages, page) || testBit(dirtyPages, page))) {
+            setBit(dirtyPages, page);
+            clearBits(protectedPages, page, 1);
+
+            mprotect(&hostBase[page << PAGE_SHIFT], PAGE_SIZE, PROT_READ | PROT_WRITE);
+
+            writeTable[page] = readTable[page];
+
+            return;
+        }
+
+        // NOTE: logging isn't async-signal-safe
+        char message[] = "Unrecognized access (addr = 0x0000000000000000)\n";
+
+        const u64 vaddr = (u64)(addr - hostBase);
+
+        for (int i = 0; i < 16; i++) {
+            message[45 - i] = "0123456789abcdef"[(vaddr >> (4 * i)) & 0xF];
+        }
+
+        (void)::write(STDERR_FILENO, message, sizeof(message) - 1);
+
+        _exit(0);
+    }
+
+    // Not a guest access, let the previous handler deal with it
+    sigaction(sig, &oldSegvAction, NULL);
+}
+
+// Releases a range of the host mapping, accesses to it will fault
+static void decommit(u64 address, u64 size) {
+    if (mmap(hostBase + address, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        PLOG_FATAL << "Failed to decommit host memory (addr = " << std::hex << address << ", size = " << size << ")";
+
+        exit(0);
+    }
+
+    // Faults in this range are real faults now
+    if (dirtyTracking) {
+        clearBits(protectedPages, address >> PAGE_SHIFT, size >> PAGE_SHIFT);
+    }
+}
+
+// Writable code pages are kept out of the write table (and the JIT page table) so that stores can be tracked
+static bool isDirectlyWritable(u32 permission) {
+    return ((permission & MemoryPermission::W) != 0) && ((permission & MemoryPermission::X) == 0);
+}
+
+static void setCodePages(u64 basePage, u64 pageNum, bool isCode) {
+    for (u64 page = basePage; page < (basePage + pageNum); page++) {
+        codePages[page] = isCode;
+    }
+}
+
+// Host protection of the host mapping, JIT fastmem accesses bypass the page tables
+// NOTE: writable code pages are read-only on the host so that stores reach the memory callbacks and invalidate translated code
+static int getHostProtection(u32 permission) {
+    if (isDirectlyWritable(permission)) {
+        return PROT_READ | PROT_WRITE;
+    }
+
+    return ((permission & (MemoryPermission::R | MemoryPermission::X)) != 0) ? PROT_READ : PROT_NONE;
+}
+
+// Maps arena memory at a range of the host mapping, the same pages can be mapped at several guest addresses
+static void mapHost(u64 address, void *mem, u64 size, u32 permission) {
+    if (!arena::contains(mem)) {
+        PLOG_FATAL << "Memory @ " << std::hex << address << " is not backed by the arena";
+
+        exit(0);
+    }
+
+    if (mmap(hostBase + address, size, getHostProtection(permission), MAP_SHARED | MAP_FIXED, arena::getFD(), arena::getOffset(mem)) == MAP_FAILED) {
+        PLOG_FATAL << "Failed to map host memory (addr = " << std::hex << address << ", size = " << size << ")";
+
+        exit(0);
+    }
+
+    if (isAlignedHeap(address) && isAlignedHeap(size)) {
+        (void)madvise(hostBase + address, size, MADV_HUGEPAGE);
+    }
+}
+
+// Fills in the page tables for a range of guest memory
+// NOTE: the tables always point to the arena, host code can write to pages the guest can't
+static void mapPages(u64 address, void *mem, u64 pageNum, u32 permission) {
+    const u64 basePage = address >> PAGE_SHIFT;
+
+    u8 *hostMem = (u8 *)mem;
+
+    if (((permission & MemoryPermission::R) != 0) || ((permission & MemoryPermission::X) != 0)) {
+        for (u64 page = 0; page < pageNum; page++) {
+            const u64 readPage = page + basePage;
+
+            if (readTable[readPage] != NULL) {
+                PLOG_FATAL << "Read page " << std::hex << readPage << " is already mapped!";
+
+                exit(0);
+            }
+
+            readTable[readPage] = &hostMem[page * PAGE_SIZE];
+        }
+    }
+
+    if (isDirectlyWritable(permission)) {
+        for (u64 page = 0; page < pageNum; page++) {
+            const u64 writePage = page + basePage;
+
+            if (writeTable[writePage] != NULL) {
+                PLOG_FATAL << "Write page " << std::hex << writePage << " is already mapped!";
+
+                exit(0);
+            }
+
+            writeTable[writePage] = &hostMem[page * PAGE_SIZE];
+        }
+    }
+
+    if ((permission & MemoryPermission::X) != 0) {
+        setCodePages(basePage, pageNum, true);
+    }
+
+    if ((permission & MemoryPermission::W) != 0) {
+        setBits(writablePages, basePage, pageNum);
+    }
+}
+
+// Clears the page tables for a range of guest memory
+static void unmapPages(u64 address, u64 pageNum) {
+    const u64 basePage = address >> PAGE_SHIFT;
+
+    bool hasCode = false;
+
+    for (u64 page = basePage; page < (basePage + pageNum); page++) {
+        readTable[page] = NULL;
+        writeTable[page] = NULL;
+
+        hasCode |= codePages[page];
+    }
+
+    clearBits(writablePages, basePage, pageNum);
+
+    // Unmapped pages are never dirty
+    if (dirtyTracking) {
+        clearBits(dirtyPages, basePage, pageNum);
+    }
+
+    // Drop translated code from the range
+    if (hasCode) {
+        setCodePages(basePage, pageNum, false);
+
+        cpu::invalidateCacheRange(address, pageNum * PAGE_SIZE);
+    }
+}
+
+static bool hasCode(u64 vaddr, u64 size) {
+    const u64 lastPage = (vaddr + size - 1) >> PAGE_SHIFT;
+
+    for (u64 page = vaddr >> PAGE_SHIFT; page <= lastPage; page++) {
+        if (codePages[page]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Invalidates translated code in a range if any of its pages hold code
+static void invalidateCodeRange(u64 vaddr, u64 size) {
+    if (hasCode(vaddr, size)) {
+        cpu::invalidateCacheRange(vaddr, size);
+    }
+}
+
+// Handles stores to writable code pages, returns false if the page isn't writable code
+static bool writeCode(u64 vaddr, const void *data, u64 size) {
+    const u64 page = vaddr >> PAGE_SHIFT;
+
+    if (!codePages[page] || (readTable[page] == NULL) || !testBit(writablePages, page)) {
+        return false;
+    }
+
+    std::memcpy(&readTable[page][vaddr & PAGE_MASK], data, size);
+
+    cpu::invalidateCacheRange(vaddr, size);
+
+    if (dirtyTracking) {
+        setBit(dirtyPages, page);
+    }
+
+    return true;
+}
+
+// Returns true if a page can be write-protected for dirty tracking
+static bool isTrackable(u64 page) {
+    return (readTable[page] != NULL) && !codePages[page] && testBit(writablePages, page);
+}
+
+// Handles the first store to a clean page, returns the writable host page (or NULL if the page isn't tracked)
+static u8 *trackWrite(u64 page) {
+    if (!dirtyTracking || (writeTable[page] != NULL) || !isTrackable(page)) {
+        return NULL;
+    }
+
+    setBit(dirtyPages, page);
+
+    if (hostBase != NULL) {
+        clearBits(protectedPages, page, 1);
+
+        mprotect(&hostBase[page << PAGE_SHIFT], PAGE_SIZE, PROT_READ | PROT_WRITE);
+    }
+
+    writeTable[page] = readTable[page];
+
+    return writeTable[page];
+}
+
+static void markDirty(u64 basePage, u64 pageNum) {
+    if (!dirtyTracking) {
+        return;
+    }
+
+    setBits(dirtyPages, basePage, pageNum);
+}
+
+// Returns host page for bulk accesses (or NULL), writable code pages are only in the read table
+static u8 *getSpanPage(u64 page, bool isWrite) {
+    if (page >= PAGE_NUM) {
+        return NULL;
+    }
+
+    if (!isWrite) {
+        return (readTable[page] != NULL) ? readTable[page] : writeTable[page];
+    }
+
+    if (writeTable[page] != NULL) {
+        return writeTable[page];
+    }
+
+    if (codePages[page] && (readTable[page] != NULL) && testBit(writablePages, page)) {
+        markDirty(page, 1);
+
+        return readTable[page];
+    }
+
+    return trackWrite(page);
+}
+
+static u64 getBlockEnd(const MemoryBlock &memoryBlock) {
+    return memoryBlock.baseAddress + memoryBlock.size * PAGE_SIZE;
+}
+
+// Returns the block containing an address
+static std::map<u64, MemoryBlock>::iterator findBlock(u64 address) {
+    return std::prev(memoryBlockRecord.upper_bound(address));
+}
+
+// Makes sure a block starts at the given address
+static void splitBlock(u64 address) {
+    if (address >= MemoryBase::AddressSpace) {
+        return;
+    }
+
+    auto it = findBlock(address);
+
+    MemoryBlock &memoryBlock = it->second;
+
+    if (memoryBlock.baseAddress == address) {
+        return;
+    }
+
+    const u64 offset = address - memoryBlock.baseAddress;
+
+    MemoryBlock upperBlock = memoryBlock;
+
+    upperBlock.baseAddress = address;
+    upperBlock.size -= offset / PAGE_SIZE;
+
+    if (upperBlock.mem != NULL) {
+        upperBlock.mem = &((u8 *)upperBlock.mem)[offset];
+    }
+
+    memoryBlock.size = offset / PAGE_SIZE;
+
+    memoryBlockRecord.emplace_hint(std::next(it), address, upperBlock);
+}
+
+static bool canMerge(const MemoryBlock &lowerBlock, const MemoryBlock &upperBlock) {
+    if ((lowerBlock.type != upperBlock.type) || (lowerBlock.attribute != upperBlock.attribute) || (lowerBlock.permission != upperBlock.permission) || (lowerBlock.isAlias != upperBlock.isAlias)) {
+        return false;
+    }
+
+    // Free blocks have no backing memory, mapped blocks need contiguous backing memory
+    if ((lowerBlock.mem == NULL) || (upperBlock.mem == NULL)) {
+        return lowerBlock.mem == upperBlock.mem;
+    }
+
+    return &((u8 *)lowerBlock.mem)[lowerBlock.size * PAGE_SIZE] == upperBlock.mem;
+}
+
+// Merges a block with its upper neighbour if both have the same state
+static void mergeBlock(std::map<u64, MemoryBlock>::iterator it) {
+    auto next = std::next(it);
+
+    if ((next == memoryBlockRecord.end()) || !canMerge(it->second, next->second)) {
+        return;
+    }
+
+    it->second.size += next->second.size;
+
+    memoryBlockRecord.erase(next);
+}
+
+// Replaces all blocks in a range with a new one
+static void insertBlock(const MemoryBlock &memoryBlock) {
+    const u64 endAddress = getBlockEnd(memoryBlock);
+
+    splitBlock(memoryBlock.baseAddress);
+    splitBlock(endAddress);
+
+    memoryBlockRecord.erase(memoryBlockRecord.find(memoryBlock.baseAddress), memoryBlockRecord.lower_bound(endAddress));
+
+    auto it = memoryBlockRecord.emplace(memoryBlock.baseAddress, memoryBlock).first;
+
+    mergeBlock(it);
+
+    if (it != memoryBlockRecord.begin()) {
+        mergeBlock(std::prev(it));
+    }
+}
+
+// Reserves a zeroed page table, host pages are allocated on first write
+static u8 **makePageTable() {
+    void *mem = mmap(NULL, PAGE_NUM * sizeof(u8 *), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (mem == MAP_FAILED) {
+        PLOG_FATAL << "Failed to reserve page table";
+
+        exit(0);
+    }
+
+    return (u8 **)mem;
+}
+
+void init() {
+    readTable = makePageTable();
+    writeTable = makePageTable();
+
+    arena::init();
+
+    memoryBlockRecord.clear();
+    memoryBlockRecord.emplace(0, MemoryBlock{.baseAddress = 0, .size = PAGE_NUM, .type = MemoryType::Free, .attribute = 0, .permission = MemoryPermission::None, .mem = NULL});
+
+    if (config::useHostMappedMemory()) {
+        PLOG_INFO << "Using host-mapped guest memory";
+
+        // Reserve one extra huge page so that guest huge page regions line up with host huge pages
+        void *mem = mmap(NULL, MemoryBase::AddressSpace + HUGE_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (mem == MAP_FAILED) {
+            PLOG_FATAL << "Failed to reserve guest address space";
+
+            exit(0);
+        }
+
+        hostBase = (u8 *)(((u64)mem + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+
+        // NOTE: this has to happen before the JIT installs its own handler, faults outside of JIT code are forwarded to us
+        struct sigaction segvAction;
+        std::memset(&segvAction, 0, sizeof(segvAction));
+
+        segvAction.sa_sigaction = &handleSegfault;
+        segvAction.sa_flags = SA_SIGINFO;
+        sigemptyset(&segvAction.sa_mask);
+
+        if (sigaction(SIGSEGV, &segvAction, &oldSegvAction) != 0) {
+            PLOG_FATAL << "Failed to install SIGSEGV handler";
+
+            exit(0);
+        }
+    }
+}
+
+u64 getAppSize() {
+    return appSize;
+}
+
+u64 getHeapSize() {
+    return heapSize;
+}
+
+u64 getUsedMemorySize() {
+    return usedMemorySize;
+}
+
+void setAppSize(u64 size) {
+    appSize = size;
+}
+
+// Resizes the heap in place, existing heap pages are never moved or copied
+// Returns true if a range of memory is (or contains) the source of a mirror
+static bool isMirrored(u64 address, u64 pageNum) {
+    const u64 endAddress = address + pageNum * PAGE_SIZE;
+
+    for (auto it = findBlock(address); (it != memoryBlockRecord.end()) && (it->first < endAddress); it++) {
+        if ((it->second.attribute & MemoryAttribute::Locked) != 0) {
+            return true;
+        }
+    }
+
+    for (const auto &[dstAddress, srcRanges] : mirrorRecord) {
+        for (const MirroredRange &srcRange : srcRanges) {
+            if ((srcRange.address < endAddress) && (address < (srcRange.address + srcRange.pageNum * PAGE_SIZE))) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool setHeapSize(u64 size) {
+    PLOG_DEBUG << "Set heap size (size = " << std::hex << size << ", old size = " << heapSize << ")";
+
+    if (size > heapSize) {
+        // Only back the new tail, the page tables make it contiguous with the rest of the heap
+        if (allocate(MemoryBase::Heap + heapSize, (size - heapSize) / PAGE_SIZE, MemoryType::Normal, 0, MemoryPermission::RW) == NULL) {
+            PLOG_FATAL << "Failed to allocate heap";
+
+            exit(0);
+        }
+    } else if (size < heapSize) {
+        // Mirrors still alias the memory of their source, it can't be freed
+        if (isMirrored(MemoryBase::Heap + size, (heapSize - size) / PAGE_SIZE)) {
+            PLOG_ERROR << "Heap tail is locked (size = " << std::hex << size << ")";
+
+            return false;
+        }
+
+        unmap(MemoryBase::Heap + size, (heapSize - size) / PAGE_SIZE);
+    }
+
+    heapSize = size;
+
+    return true;
+}
+
+// Handles accesses the inline accessors can't: out-of-bounds, page-crossing, writable code and unmapped pages
+template<typename T>
+T readSlow(u64 vaddr) {
+    if (vaddr > (MemoryBase::AddressSpace - sizeof(T))) {
+        PLOG_FATAL << "Read" << 8 * sizeof(T) << " address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+
+        exit(0);
+    }
+
+    // Accesses crossing a page boundary are split into byte accesses
+    if ((vaddr & PAGE_MASK) > (PAGE_SIZE - sizeof(T))) {
+        T data = 0;
+
+        for (u64 i = 0; i < sizeof(T); i++) {
+            data |= (T)read<u8>(vaddr + i) << (8 * i);
+        }
+
+        return data;
+    }
+
+    switch (vaddr) {
+        default:
+            PLOG_FATAL << "Unrecognized read" << 8 * sizeof(T) << " (addr = " << std::hex << vaddr << ")";
+
+            exit(0);
+    }
+}
+
+template<typename T>
+void writeSlow(u64 vaddr, T data) {
+    if (vaddr > (MemoryBase::AddressSpace - sizeof(T))) {
+        PLOG_FATAL << "Write" << 8 * sizeof(T) << " address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+
+        exit(0);
+    }
+
+    if ((vaddr & PAGE_MASK) > (PAGE_SIZE - sizeof(T))) {
+        for (u64 i = 0; i < sizeof(T); i++) {
+            write<u8>(vaddr + i, (u8)(data >> (8 * i)));
+        }
+
+        return;
+    }
+
+    u8 *mem = trackWrite(vaddr >> PAGE_SHIFT);
+
+    if (mem != NULL) {
+        std::memcpy(&mem[vaddr & PAGE_MASK], &data, sizeof(T));
+
+        return;
+    }
+
+    if (writeCode(vaddr, &data, sizeof(T))) {
+        return;
+    }
+
+    switch (vaddr) {
+        default:
+            PLOG_FATAL << "Unrecognized write" << 8 * sizeof(T) << " (addr = " << std::hex << vaddr << ", data = " << (u64)data << ")";
+
+            exit(0);
+    }
+}
+
+template u8 readSlow<u8>(u64 vaddr);
+template u16 readSlow<u16>(u64 vaddr);
+template u32 readSlow<u32>(u64 vaddr);
+template u64 readSlow<u64>(u64 vaddr);
+
+template void writeSlow<u8>(u64 vaddr, u8 data);
+template void writeSlow<u16>(u64 vaddr, u16 data);
+template void writeSlow<u32>(u64 vaddr, u32 data);
+template void writeSlow<u64>(u64 vaddr, u64 data);
+
+void *getPointer(u64 vaddr) {
+    if (vaddr >= MemoryBase::AddressSpace) {
+        PLOG_FATAL << "Pointer address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+
+        exit(0);
+    }
+
+    const u64 page = vaddr >> PAGE_SHIFT;
+
+    // Check both read and write tables
+    if (readTable[page] != 0) {
+        return (void *)&readTable[page][vaddr & PAGE_MASK];
+    } else if (writeTable[page] != 0) {
+        return (void *)&writeTable[page][vaddr & PAGE_MASK];
+    }
+
+    PLOG_FATAL << "Invalid pointer (addr = " << std::hex << vaddr << ")";
+
+    exit(0);
+}
+
+// Returns host pointer to writable guest memory, or NULL if the page isn't writable
+void *getWritePointer(u64 vaddr) {
+    if (vaddr >= MemoryBase::AddressSpace) {
+        return NULL;
+    }
+
+    u8 *page = writeTable[vaddr >> PAGE_SHIFT];
+
+    if (page == NULL) {
+        page = trackWrite(vaddr >> PAGE_SHIFT);
+    }
+
+    if (page == NULL) {
+        return NULL;
+    }
+
+    return (void *)&page[vaddr & PAGE_MASK];
+}
+
+// Returns host pointer to readable guest memory, or NULL if the page isn't readable
+const void *getReadPointer(u64 vaddr) {
+    if (vaddr >= MemoryBase::AddressSpace) {
+        return NULL;
+    }
+
+    const u8 *page = readTable[vaddr >> PAGE_SHIFT];
+
+    if (page == NULL) {
+        return NULL;
+    }
+
+    return (const void *)&page[vaddr & PAGE_MASK];
+}
+
+// Returns host pointer to the host-contiguous run starting at vaddr (at most size bytes long), sets spanSize to its length
+u8 *getSpan(u64 vaddr, u64 size, bool isWrite, u64 &spanSize) {
+    if ((size == 0) || (vaddr >= MemoryBase::AddressSpace) || (size > (MemoryBase::AddressSpace - vaddr))) {
+        PLOG_FATAL << "Span outside of address space bounds (addr = " << std::hex << vaddr << ", size = " << size << ")";
+
+        exit(0);
+    }
+
+    // Writable code is read-only in the host mapping
+    if ((hostBase != NULL) && (!isWrite || !hasCode(vaddr, size))) {
+        spanSize = size;
+
+        return &hostBase[vaddr];
+    }
+
+    u64 page = vaddr >> PAGE_SHIFT;
+
+    u8 *mem = getSpanPage(page, isWrite);
+
+    if (mem == NULL) {
+        PLOG_FATAL << "Invalid " << (isWrite ? "write" : "read") << " span (addr = " << std::hex << vaddr << ", size = " << size << ")";
+
+        exit(0);
+    }
+
+    mem = &mem[vaddr & PAGE_MASK];
+
+    spanSize = std::min(size, PAGE_SIZE - (vaddr & PAGE_MASK));
+
+    // Extend the run while the next page follows on the host
+    while (spanSize < size) {
+        page++;
+
+        if (getSpanPage(page, isWrite) != &mem[spanSize]) {
+            break;
+        }
+
+        spanSize += std::min(size - spanSize, PAGE_SIZE);
+    }
+
+    if (isWrite) {
+        invalidateCodeRange(vaddr, spanSize);
+    }
+
+    return mem;
+}
+
+void readBlock(u64 vaddr, void *data, u64 size) {
+    forEachSpan(vaddr, size, false, [&](const u8 *mem, u64 spanSize) {
+        std::memcpy(data, mem, spanSize);
+
+        data = &((u8 *)data)[spanSize];
+    });
+}
+
+void writeBlock(u64 vaddr, const void *data, u64 size) {
+    forEachSpan(vaddr, size, true, [&](u8 *mem, u64 spanSize) {
+        std::memcpy(mem, data, spanSize);
+
+        data = &((const u8 *)data)[spanSize];
+    });
+}
+
+// Copies between guest ranges, overlapping ranges behave like memmove()
+void copyBlock(u64 dst, u64 src, u64 size) {
+    if ((dst < (src + size)) && (src < (dst + size)) && (dst != src)) {
+        std::vector<u8> buffer(size);
+
+        readBlock(src, buffer.data(), size);
+        writeBlock(dst, buffer.data(), size);
+
+        return;
+    }
+
+    while (size != 0) {
+        u64 dstSize, srcSize;
+
+        u8 *dstMem = getSpan(dst, size, true, dstSize);
+        const u8 *srcMem = getSpan(src, size, false, srcSize);
+
+        const u64 chunkSize = std::min(dstSize, srcSize);
+
+        std::memcpy(dstMem, srcMem, chunkSize);
+
+        dst += chunkSize;
+        src += chunkSize;
+        size -= chunkSize;
+    }
+}
+
+void fill(u64 vaddr, u8 data, u64 size) {
+    forEachSpan(vaddr, size, true, [&](u8 *mem, u64 spanSize) {
+        std::memset(mem, data, spanSize);
+    });
+}
+
+// Returns the host mapping of the guest address space, or NULL if guest memory isn't host-mapped
+u8 *getHostBase() {
+    return hostBase;
+}
+
+// Returns the page table used by the JIT for inline address translation
+// NOTE: the JIT uses the same table for reads and writes, so only writable pages are exposed.
+// Read-only pages and unmapped pages fall back to the memory callbacks
+void **getPageTable() {
+    return (void **)writeTable;
+}
+
+void map(void *mem, u64 address, u64 pageNum, u32 type, u32 attribute, u32 permission) {
+    PLOG_DEBUG << "Mapping " << pageNum << " pages @ " << std::hex << address << " " << getPermissionString(permission);
+
+    MemoryBlock memoryBlock{.baseAddress = address, .size = pageNum, .type = type, .attribute = attribute, .permission = permission, .mem = mem, .isAlias = true};
+
+    if (hostBase != NULL) {
+        // Create a second mapping of the same pages
+        mapHost(address, mem, pageNum * PAGE_SIZE, permission);
+    }
+
+    mapPages(address, mem, pageNum, permission);
+
+    markDirty(address >> PAGE_SHIFT, pageNum);
+
+    insertBlock(memoryBlock);
+}
+
+static u32 getCategory(u32 type) {
+    switch (type) {
+        case MemoryType::Code:
+        case MemoryType::CodeData:
+            return telemetry::Category::Code;
+        case MemoryType::Normal:
+            return telemetry::Category::Heap;
+        case MemoryType::Stack:
+            return telemetry::Category::Stack;
+        case MemoryType::ThreadLocal:
+            return telemetry::Category::TLS;
+        default:
+            return telemetry::Category::Other;
+    }
+}
+
+// Returns true if memory backing a block was allocated by us (and not by e.g. a shared memory object)
+static bool isOwned(const MemoryBlock &memoryBlock) {
+    return (memoryBlock.mem != NULL) && !memoryBlock.isAlias && arena::contains(memoryBlock.mem);
+}
 
-// Page tables
-std::array<u8 *, PAGE_NUM> readTable, writeTable;
+// Gives memory backing a range back to the host, unmapped pages read back as zeroes once they are reused
+static void releaseRange(u64 address, u64 pageNum) {
+    const u64 endAddress = address + pageNum * PAGE_SIZE;
 
-std::list<MemoryBlock> memoryBlockRecord;
+    splitBlock(address);
+    splitBlock(endAddress);
 
-u64 appSize = 0;
-u64 heapSize = 0;
-u64 usedMemorySize = 0;
+    for (auto it = memoryBlockRecord.find(address); (it != memoryBlockRecord.end()) && (it->first < endAddress); it++) {
+        const MemoryBlock &memoryBlock = it->second;
 
-void init() {
-    // Clear page tables
-    for (auto &i : readTable) {
-        i = NULL;
-    }
+        if (!isOwned(memoryBlock)) {
+            continue;
+        }
 
-    for (auto &i : writeTable) {
-        i = NULL;
+        arena::free(memoryBlock.mem, memoryBlock.size * PAGE_SIZE);
+
+        usedMemorySize -= memoryBlock.size * PAGE_SIZE;
+
+        telemetry::remove(getCategory(memoryBlock.type), memoryBlock.size * PAGE_SIZE);
     }
 }
 
-u64 getAppSize() {
-    return appSize;
-}
+static void unmapRange(u64 address, u64 pageNum, bool release) {
+    PLOG_DEBUG << "Unmapping " << pageNum << " pages @ " << std::hex << address;
 
-u64 getHeapSize() {
-    return heapSize;
-}
+    if (release) {
+        releaseRange(address, pageNum);
+    }
 
-u64 getUsedMemorySize() {
-    return usedMemorySize;
+    // Turn the range back into a free block, splitting partially unmapped blocks
+    insertBlock(MemoryBlock{.baseAddress = address, .size = pageNum, .type = MemoryType::Free, .attribute = 0, .permission = MemoryPermission::None, .mem = NULL});
+
+    unmapPages(address, pageNum);
+
+    if (hostBase != NULL) {
+        decommit(address, pageNum * PAGE_SIZE);
+    }
 }
 
-void setAppSize(u64 size) {
-    appSize = size;
+void unmap(u64 address, u64 pageNum) {
+    unmapRange(address, pageNum, true);
 }
 
-void setHeapSize(u64 size) {
-    if (heapSize != 0) {
-        PLOG_FATAL << "Unimplemented heap resizing";
+// Allocates linear block of memory, returns pointer to allocated block (or NULL)
+void *allocate(u64 baseAddress, u64 pageNum, u32 type, u32 attribute, u32 permission) {
+    PLOG_DEBUG << "Allocating " << pageNum << " pages @ " << std::hex << baseAddress << " " << getPermissionString(permission);
 
-        exit(0);
-    }
+    if (!isAligned(baseAddress)) {
+        PLOG_ERROR << "Base address is not aligned";
 
-    PLOG_DEBUG << "Set heap size (size = " << std::hex << size << ")";
+        return NULL;
+    }
 
-    if (allocate(MemoryBase::Heap, size / PAGE_SIZE, 0, 0, MemoryPermission::RW) == NULL) {
-        PLOG_FATAL << "Failed to allocate heap";
+    if (pageNum == 0) {
+        PLOG_ERROR << "Requested zero pages";
 
-        exit(0);
+        return NULL;
     }
 
-    heapSize = size;
-}
+    MemoryBlock memoryBlock{.baseAddress = baseAddress, .size = pageNum, .type = type, .attribute = attribute, .permission = permission, .mem = NULL};
 
-u8 read8(u64 vaddr) {
-    if (vaddr >= MemoryBase::AddressSpace) {
-        PLOG_FATAL << "Read8 address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+    memoryBlock.mem = arena::allocate(pageNum * PAGE_SIZE);
 
-        exit(0);
+    if (memoryBlock.mem == NULL) {
+        PLOG_ERROR << "Failed to allocate memory";
+
+        return NULL;
     }
 
-    const u64 page = vaddr >> PAGE_SHIFT;
+    if (hostBase != NULL) {
+        // NOTE: guest permissions are enforced by host protection here, the loader writes through the returned (arena) pointer
+        mapHost(baseAddress, memoryBlock.mem, pageNum * PAGE_SIZE, permission);
+    }
 
-    if (readTable[page] != NULL) {
-        return readTable[page][vaddr & PAGE_MASK];
-    } else {
-        switch (vaddr) {
-            default:
-                PLOG_FATAL << "Unrecognized read8 (addr = " << std::hex << vaddr << ")";
+    mapPages(baseAddress, memoryBlock.mem, pageNum, permission);
 
-                exit(0);
-        }
-    }
-}
+    usedMemorySize += pageNum * PAGE_SIZE;
 
-u16 read16(u64 vaddr) {
-    if (vaddr > (MemoryBase::AddressSpace - sizeof(u16))) {
-        PLOG_FATAL << "Read16 address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+    if (usedMemorySize > TOTAL_MEMORY_SIZE) {
+        PLOG_FATAL << "Ran out of memory";
 
         exit(0);
     }
 
-    const u64 page = vaddr >> PAGE_SHIFT;
+    telemetry::add(getCategory(type), pageNum * PAGE_SIZE);
 
-    if (readTable[page] != NULL) {
-        u16 data;
-        std::memcpy(&data, &readTable[page][vaddr & PAGE_MASK], sizeof(u16));
-        
-        return data;
-    } else {
-        switch (vaddr) {
-            default:
-                PLOG_FATAL << "Unrecognized read16 (addr = " << std::hex << vaddr << ")";
+    markDirty(baseAddress >> PAGE_SHIFT, pageNum);
 
-                exit(0);
-        }
-    }
+    insertBlock(memoryBlock);
+
+    return memoryBlock.mem;
 }
 
-u32 read32(u64 vaddr) {
-    if (vaddr > (MemoryBase::AddressSpace - sizeof(u32))) {
-        PLOG_FATAL << "Read32 address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+u64 allocateTLS() {
+    static u64 TLS_BASE = MemoryBase::TLSBase;
 
-        exit(0);
-    }
+    (void)allocate(TLS_BASE, 1, MemoryType::ThreadLocal, 0, MemoryPermission::RW);
 
-    const u64 page = vaddr >> PAGE_SHIFT;
+    const u64 tlsBase = TLS_BASE;
 
-    if (readTable[page] != NULL) {
-        u32 data;
-        std::memcpy(&data, &readTable[page][vaddr & PAGE_MASK], sizeof(u32));
-        
-        return data;
-    } else {
-        switch (vaddr) {
-            default:
-                PLOG_FATAL << "Unrecognized read32 (addr = " << std::hex << vaddr << ")";
+    TLS_BASE += PAGE_SIZE;
 
-                exit(0);
-        }
-    }
+    return tlsBase;
 }
 
-u64 read64(u64 vaddr) {
-    if (vaddr > (MemoryBase::AddressSpace - sizeof(u64))) {
-        PLOG_FATAL << "Read64 address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+// Write-protects clean pages in a range (or lifts the protection)
+static void protectRange(u64 address, u64 pageNum, bool protect) {
+    const u64 endAddress = address + pageNum * PAGE_SIZE;
 
-        exit(0);
-    }
+    for (auto it = findBlock(address); (it != memoryBlockRecord.end()) && (it->first < endAddress); it++) {
+        const MemoryBlock &memoryBlock = it->second;
 
-    const u64 page = vaddr >> PAGE_SHIFT;
+        // Write-only pages have nothing to restore the write table from, leave them alone
+        if ((memoryBlock.mem == NULL) || !isDirectlyWritable(memoryBlock.permission) || ((memoryBlock.permission & MemoryPermission::R) == 0)) {
+            continue;
+        }
 
-    if (readTable[page] != NULL) {
-        u64 data;
-        std::memcpy(&data, &readTable[page][vaddr & PAGE_MASK], sizeof(u64));
-        
-        return data;
-    } else {
-        switch (vaddr) {
-            default:
-                PLOG_FATAL << "Unrecognized read64 (addr = " << std::hex << vaddr << ")";
+        const u64 basePage = std::max(address, memoryBlock.baseAddress) >> PAGE_SHIFT;
+        const u64 lastPage = std::min(endAddress, getBlockEnd(memoryBlock)) >> PAGE_SHIFT;
 
-                exit(0);
+        // NOTE: the write table is the JIT page table, clean pages have to be left out in host-mapped mode too.
+        // Otherwise stores the JIT moved off the fastmem path would fault in JIT code
+        if (protect) {
+            for (u64 page = basePage; page < lastPage; page++) {
+                writeTable[page] = NULL;
+            }
+        }
+
+        if (hostBase != NULL) {
+            if (protect) {
+                setBits(protectedPages, basePage, lastPage - basePage);
+            } else {
+                clearBits(protectedPages, basePage, lastPage - basePage);
+            }
+
+            mprotect(&hostBase[basePage << PAGE_SHIFT], (lastPage - basePage) << PAGE_SHIFT, protect ? PROT_READ : (PROT_READ | PROT_WRITE));
+        }
+
+        if (!protect) {
+            for (u64 page = basePage; page < lastPage; page++) {
+                writeTable[page] = readTable[page];
+            }
         }
     }
 }
 
-void write8(u64 vaddr, u8 data) {
-    if (vaddr >= MemoryBase::AddressSpace) {
-        PLOG_FATAL << "Write8 address outside of address space bounds (addr = " << std::hex << vaddr << ")";
-
-        exit(0);
+// NOTE: the dirty tracking functions are meant to be called while the cores are paused
+void setDirtyTracking(bool enable) {
+    if (enable == dirtyTracking) {
+        return;
     }
 
-    const u64 page = vaddr >> PAGE_SHIFT;
+    PLOG_INFO << (enable ? "Enabling" : "Disabling") << " dirty page tracking";
 
-    if (writeTable[page] != NULL) {
-        writeTable[page][vaddr & PAGE_MASK] = data;
-    } else {
-        switch (vaddr) {
-            default:
-                PLOG_FATAL << "Unrecognized write8 (addr = " << std::hex << vaddr << ", data = " << data << ")";
+    if (enable) {
+        dirtyPages.assign(PAGE_NUM / 64, 0);
 
-                exit(0);
+        if (hostBase != NULL) {
+            protectedPages.assign(PAGE_NUM / 64, 0);
         }
+
+        dirtyTracking = true;
+
+        protectRange(0, PAGE_NUM, true);
+    } else {
+        protectRange(0, PAGE_NUM, false);
+
+        dirtyTracking = false;
+
+        dirtyPages = std::vector<u64>();
+        protectedPages = std::vector<u64>();
     }
 }
 
-void write16(u64 vaddr, u16 data) {
-    if (vaddr > (MemoryBase::AddressSpace - sizeof(u16))) {
-        PLOG_FATAL << "Write16 address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+bool isDirtyTracking() {
+    return dirtyTracking;
+}
 
-        exit(0);
+// Returns true if any page in a range was written since it was last cleared (always true without tracking)
+bool isDirty(u64 address, u64 size) {
+    if (!dirtyTracking) {
+        return true;
     }
 
-    const u64 page = vaddr >> PAGE_SHIFT;
-
-    if (writeTable[page] != NULL) {
-        std::memcpy(&writeTable[page][vaddr & PAGE_MASK], &data, sizeof(u16));
-    } else {
-        switch (vaddr) {
-            default:
-                PLOG_FATAL << "Unrecognized write16 (addr = " << std::hex << vaddr << ", data = " << data << ")";
+    const u64 lastPage = (address + size - 1) >> PAGE_SHIFT;
 
-                exit(0);
+    for (u64 page = address >> PAGE_SHIFT; page <= lastPage; page++) {
+        if (testBit(dirtyPages, page)) {
+            return true;
         }
     }
+
+    return false;
 }
 
-void write32(u64 vaddr, u32 data) {
-    if (vaddr > (MemoryBase::AddressSpace - sizeof(u32))) {
-        PLOG_FATAL << "Write32 address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+// Returns dirty runs (address, size) in a range
+std::vector<std::pair<u64, u64>> getDirtyRanges(u64 address, u64 size) {
+    std::vector<std::pair<u64, u64>> ranges;
 
-        exit(0);
+    if (!dirtyTracking) {
+        ranges.emplace_back(address, size);
+
+        return ranges;
     }
 
-    const u64 page = vaddr >> PAGE_SHIFT;
+    const u64 endPage = (address + size + PAGE_MASK) >> PAGE_SHIFT;
 
-    if (writeTable[page] != NULL) {
-        std::memcpy(&writeTable[page][vaddr & PAGE_MASK], &data, sizeof(u32));
-    } else {
-        switch (vaddr) {
-            default:
-                PLOG_FATAL << "Unrecognized write32 (addr = " << std::hex << vaddr << ", data = " << data << ")";
+    for (u64 page = address >> PAGE_SHIFT; page < endPage; page++) {
+        // Skip clean words
+        if (((page & 63) == 0) && (dirtyPages[page >> 6] == 0)) {
+            page += 63;
 
-                exit(0);
+            continue;
+        }
+
+        if (!testBit(dirtyPages, page)) {
+            continue;
+        }
+
+        const u64 pageAddress = page << PAGE_SHIFT;
+
+        if (!ranges.empty() && ((ranges.back().first + ranges.back().second) == pageAddress)) {
+            ranges.back().second += PAGE_SIZE;
+        } else {
+            ranges.emplace_back(pageAddress, PAGE_SIZE);
         }
     }
-}
 
-void write64(u64 vaddr, u64 data) {
-    if (vaddr > (MemoryBase::AddressSpace - sizeof(u64))) {
-        PLOG_FATAL << "Write64 address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+    return ranges;
+}
 
-        exit(0);
+// Marks a range as clean, the next store to each page sets its dirty bit again
+void clearDirty(u64 address, u64 size) {
+    if (!dirtyTracking) {
+        return;
     }
 
-    const u64 page = vaddr >> PAGE_SHIFT;
+    const u64 basePage = address >> PAGE_SHIFT;
+    const u64 endPage = std::min((address + size + PAGE_MASK) >> PAGE_SHIFT, PAGE_NUM);
 
-    if (writeTable[page] != NULL) {
-        std::memcpy(&writeTable[page][vaddr & PAGE_MASK], &data, sizeof(u64));
-    } else {
-        switch (vaddr) {
-            default:
-                PLOG_FATAL << "Unrecognized write64 (addr = " << std::hex << vaddr << ", data = " << data << ")";
+    // Unmapped pages are never dirty, only clear mapped blocks
+    for (auto it = findBlock(basePage << PAGE_SHIFT); (it != memoryBlockRecord.end()) && ((it->first >> PAGE_SHIFT) < endPage); it++) {
+        const MemoryBlock &memoryBlock = it->second;
 
-                exit(0);
+        if (memoryBlock.mem == NULL) {
+            continue;
         }
-    }
-}
 
-void *getPointer(u64 vaddr) {
-    if (vaddr >= MemoryBase::AddressSpace) {
-        PLOG_FATAL << "Pointer address outside of address space bounds (addr = " << std::hex << vaddr << ")";
+        const u64 firstPage = std::max(basePage, memoryBlock.baseAddress >> PAGE_SHIFT);
+        const u64 lastPage = std::min(endPage, getBlockEnd(memoryBlock) >> PAGE_SHIFT);
 
-        exit(0);
+        clearBits(dirtyPages, firstPage, lastPage - firstPage);
     }
 
-    const u64 page = vaddr >> PAGE_SHIFT;
+    protectRange(basePage << PAGE_SHIFT, endPage - basePage, true);
+}
 
-    // Check both read and write tables
-    if (readTable[page] != 0) {
-        return (void *)&readTable[page][vaddr & PAGE_MASK];
-    } else if (writeTable[page] != 0) {
-        return (void *)&writeTable[page][vaddr & PAGE_MASK];
+// Coalesces blocks in a range that ended up in the same state again
+static void coalesceRange(u64 address, u64 endAddress) {
+    auto it = memoryBlockRecord.find(address);
+
+    if (it != memoryBlockRecord.begin()) {
+        it = std::prev(it);
     }
 
-    PLOG_FATAL << "Invalid pointer (addr = " << std::hex << vaddr << ")";
+    while ((it != memoryBlockRecord.end()) && (it->first <= endAddress)) {
+        const u64 size = it->second.size;
 
-    exit(0);
+        mergeBlock(it);
+
+        if (it->second.size == size) {
+            it++;
+        }
+    }
 }
 
-void map(void *mem, u64 address, u64 pageNum, u32 type, u32 attribute, u32 permission) {
-    PLOG_DEBUG << "Mapping " << pageNum << " pages @ " << std::hex << address << " " << getPermissionString(permission);
+// Returns the host memory backing a page table
+static u64 getResidentSize(const void *table) {
+    const u64 hostPageSize = (u64)sysconf(_SC_PAGESIZE);
+    const u64 tableSize = PAGE_NUM * sizeof(u8 *);
 
-    MemoryBlock memoryBlock{.baseAddress = address, .size = pageNum, .type = type, .attribute = attribute, .permission = permission, .mem = mem};
+    std::vector<unsigned char> residentPages((tableSize + hostPageSize - 1) / hostPageSize);
 
-    const u64 basePage = address >> PAGE_SHIFT;
+    if (mincore((void *)table, tableSize, residentPages.data()) != 0) {
+        return 0;
+    }
 
-    if (((memoryBlock.permission & MemoryPermission::R) != 0) || ((memoryBlock.permission & MemoryPermission::X) != 0)) {
-        for (u64 page = 0; page < pageNum; page++) {
-            const u64 readPage = page + basePage;
+    return (u64)std::count_if(residentPages.begin(), residentPages.end(), [](unsigned char page) { return (page & 1) != 0; }) * hostPageSize;
+}
 
-            if (readTable[readPage] != NULL) {
-                PLOG_FATAL << "Read page " << std::hex << readPage << " is already mapped!";
+u64 getPageTableSize() {
+    u64 size = getResidentSize(readTable) + getResidentSize(writeTable);
 
-                exit(0);
-            }
+    size += codePages.capacity() / 8;
+    size += (writablePages.capacity() + dirtyPages.capacity() + protectedPages.capacity()) * sizeof(u64);
 
-            readTable[readPage] = &((u8 *)memoryBlock.mem)[page * PAGE_SIZE];
-        }
-    }
+    return size;
+}
 
-    if ((memoryBlock.permission & MemoryPermission::W) != 0) {
-        for (u64 page = 0; page < pageNum; page++) {
-            const u64 writePage = page + basePage;
+// Sets attribute bits on a range of mapped memory
+void setAttribute(u64 address, u64 pageNum, u32 mask, u32 value) {
+    PLOG_DEBUG << "Setting memory attribute (addr = " << std::hex << address << ", pages = " << pageNum << ", mask = " << mask << ", value = " << value << ")";
 
-            if (writeTable[writePage] != NULL) {
-                PLOG_FATAL << "Write page " << std::hex << writePage << " is already mapped!";
+    const u64 endAddress = address + pageNum * PAGE_SIZE;
 
-                exit(0);
-            }
+    splitBlock(address);
+    splitBlock(endAddress);
 
-            writeTable[writePage] = &((u8 *)memoryBlock.mem)[page * PAGE_SIZE];
-        }
+    for (auto it = memoryBlockRecord.find(address); (it != memoryBlockRecord.end()) && (it->first < endAddress); it++) {
+        it->second.attribute = (it->second.attribute & ~mask) | (value & mask);
     }
 
-    memoryBlockRecord.push_back(memoryBlock);
+    coalesceRange(address, endAddress);
 }
 
-void remap(u64 srcAddress, u64 dstAddress, u64 pageNum) {
-    PLOG_DEBUG << "Remapping " << pageNum << " pages from " << std::hex << srcAddress << " to " << dstAddress;
-
-    const MemoryBlock memoryBlock = queryMemory(srcAddress);
+// Changes the permission of a range of mapped memory, rebuilding its page table entries
+static void reprotect(u64 address, u64 pageNum, u32 permission) {
+    const u64 endAddress = address + pageNum * PAGE_SIZE;
 
-    const u64 srcPage = srcAddress >> PAGE_SHIFT;
-    const u64 dstPage = dstAddress >> PAGE_SHIFT;
+    splitBlock(address);
+    splitBlock(endAddress);
 
-    if (((memoryBlock.permission & MemoryPermission::R) != 0) || ((memoryBlock.permission & MemoryPermission::X) != 0)) {
-        for (u64 page = 0; page < pageNum; page++) {
-            const u64 readPage = page + dstPage;
+    unmapPages(address, pageNum);
 
-            if (readTable[readPage] != NULL) {
-                PLOG_FATAL << "Read page " << std::hex << readPage << " is already mapped!";
+    for (auto it = memoryBlockRecord.find(address); (it != memoryBlockRecord.end()) && (it->first < endAddress); it++) {
+        MemoryBlock &memoryBlock = it->second;
 
-                exit(0);
-            }
+        if (memoryBlock.mem == NULL) {
+            PLOG_FATAL << "Reprotecting unmapped memory @ " << std::hex << memoryBlock.baseAddress;
 
-            readTable[readPage] = readTable[page + srcPage];
+            exit(0);
         }
-    }
 
-    if ((memoryBlock.permission & MemoryPermission::W) != 0) {
-        for (u64 page = 0; page < pageNum; page++) {
-            const u64 writePage = page + dstPage;
+        memoryBlock.permission = permission;
 
-            if (writeTable[writePage] != NULL) {
-                PLOG_FATAL << "Write page " << std::hex << writePage << " is already mapped!";
+        mapPages(memoryBlock.baseAddress, memoryBlock.mem, memoryBlock.size, permission);
 
-                exit(0);
-            }
+        if (hostBase != NULL) {
+            mprotect(&hostBase[memoryBlock.baseAddress], memoryBlock.size * PAGE_SIZE, getHostProtection(permission));
+        }
 
-            writeTable[writePage] = writeTable[page + srcPage];
+        // Tables were rebuilt from scratch, dirty tracking has to catch the next store again
+        if (dirtyTracking && isDirectlyWritable(permission)) {
+            protectRange(memoryBlock.baseAddress, memoryBlock.size, true);
         }
     }
 
-    unmap(srcAddress, pageNum);
+    coalesceRange(address, endAddress);
 }
 
-void unmap(u64 address, u64 pageNum) {
-    PLOG_DEBUG << "Unmapping " << pageNum << " pages @ " << std::hex << address;
+// Maps the pages of one range at another address, both ranges share the same memory
+// NOTE: the source range becomes inaccessible (and locked) until the mirror is unmapped, mirrors are stack memory like on HW
+void mirror(u64 srcAddress, u64 dstAddress, u64 pageNum) {
+    PLOG_DEBUG << "Mirroring " << pageNum << " pages from " << std::hex << srcAddress << " to " << dstAddress;
 
-    // Delete memory block
-    for (auto it = memoryBlockRecord.begin(); it != memoryBlockRecord.end(); it++) {
-        if (it->baseAddress == address) {
-            memoryBlockRecord.erase(it);
-            break;
-        }
+    const u64 srcEnd = srcAddress + pageNum * PAGE_SIZE;
 
-        if (it == memoryBlockRecord.end()) {
-            PLOG_FATAL << "Unable to find memory block with base address " << std::hex << address;
+    if (mirrorRecord.find(dstAddress) != mirrorRecord.end()) {
+        PLOG_FATAL << "Memory @ " << std::hex << dstAddress << " is already a mirror";
 
-            exit(0);
-        }
+        exit(0);
     }
 
-    const u64 basePage = address >> PAGE_SHIFT;
+    splitBlock(srcAddress);
+    splitBlock(srcEnd);
 
-    for (u64 page = basePage; page < (basePage + pageNum); page++) {
-        readTable[page] = NULL;
-        writeTable[page] = NULL;
-    }
-}
+    std::vector<MirroredRange> &srcRanges = mirrorRecord[dstAddress];
 
-// Allocates linear block of memory, returns pointer to allocated block (or NULL)
-void *allocate(u64 baseAddress, u64 pageNum, u32 type, u32 attribute, u32 permission) {
-    PLOG_DEBUG << "Allocating " << pageNum << " pages @ " << std::hex << baseAddress << " " << getPermissionString(permission);
+    for (auto it = memoryBlockRecord.find(srcAddress); (it != memoryBlockRecord.end()) && (it->first < srcEnd); it++) {
+        const MemoryBlock &memoryBlock = it->second;
 
-    if (!isAligned(baseAddress)) {
-        PLOG_ERROR << "Base address is not aligned";
+        if (memoryBlock.mem == NULL) {
+            PLOG_FATAL << "Mirroring unmapped memory @ " << std::hex << memoryBlock.baseAddress;
 
-        return NULL;
-    }
+            exit(0);
+        }
 
-    if (pageNum == 0) {
-        PLOG_ERROR << "Requested zero pages";
+        srcRanges.push_back(MirroredRange{.address = memoryBlock.baseAddress, .pageNum = memoryBlock.size, .permission = memoryBlock.permission});
 
-        return NULL;
-    }
+        const u64 address = dstAddress + (memoryBlock.baseAddress - srcAddress);
 
-    MemoryBlock memoryBlock{.baseAddress = baseAddress, .size = pageNum, .type = type, .attribute = attribute, .permission = permission, .mem = NULL};
-    memoryBlock.mem = std::malloc(pageNum * PAGE_SIZE);
+        if (hostBase != NULL) {
+            mapHost(address, memoryBlock.mem, memoryBlock.size * PAGE_SIZE, MemoryPermission::RW);
+        }
 
-    if (memoryBlock.mem == NULL) {
-        PLOG_ERROR << "Failed to allocate memory";
+        mapPages(address, memoryBlock.mem, memoryBlock.size, MemoryPermission::RW);
 
-        return NULL;
+        markDirty(address >> PAGE_SHIFT, memoryBlock.size);
+
+        insertBlock(MemoryBlock{.baseAddress = address, .size = memoryBlock.size, .type = MemoryType::Stack, .attribute = 0, .permission = MemoryPermission::RW, .mem = memoryBlock.mem, .isAlias = true});
     }
 
-    const u64 basePage = baseAddress >> PAGE_SHIFT;
+    reprotect(srcAddress, pageNum, MemoryPermission::None);
 
-    if (((memoryBlock.permission & MemoryPermission::R) != 0) || ((memoryBlock.permission & MemoryPermission::X) != 0)) {
-        for (u64 page = 0; page < pageNum; page++) {
-            const u64 readPage = page + basePage;
+    setAttribute(srcAddress, pageNum, MemoryAttribute::Locked, MemoryAttribute::Locked);
+}
 
-            if (readTable[readPage] != NULL) {
-                PLOG_FATAL << "Failed to map read page";
+// Returns true if [dstAddress, dstAddress + pageNum) still maps the memory of the source range
+static bool isMirrorOf(u64 srcAddress, u64 dstAddress, u64 pageNum) {
+    const u64 dstEnd = dstAddress + pageNum * PAGE_SIZE;
 
-                exit(0);
-            }
+    for (auto it = findBlock(dstAddress); (it != memoryBlockRecord.end()) && (it->first < dstEnd); it++) {
+        const MemoryBlock &dstBlock = it->second;
 
-            readTable[readPage] = &((u8 *)memoryBlock.mem)[page * PAGE_SIZE];
+        if ((dstBlock.mem == NULL) || !dstBlock.isAlias) {
+            return false;
         }
-    }
 
-    if ((memoryBlock.permission & MemoryPermission::W) != 0) {
-        for (u64 page = 0; page < pageNum; page++) {
-            const u64 writePage = page + basePage;
+        const u64 address = std::max(dstAddress, dstBlock.baseAddress);
 
-            if (writeTable[writePage] != NULL) {
-                PLOG_FATAL << "Failed to map write page";
+        const MemoryBlock &srcBlock = findBlock(srcAddress + (address - dstAddress))->second;
 
-                exit(0);
-            }
+        if (srcBlock.mem == NULL) {
+            return false;
+        }
 
-            writeTable[writePage] = &((u8 *)memoryBlock.mem)[page * PAGE_SIZE];
+        const u8 *dstMem = (const u8 *)dstBlock.mem + (address - dstBlock.baseAddress);
+        const u8 *srcMem = (const u8 *)srcBlock.mem + (srcAddress + (address - dstAddress) - srcBlock.baseAddress);
+
+        if (dstMem != srcMem) {
+            return false;
         }
     }
 
-    usedMemorySize += pageNum * PAGE_SIZE;
-
-    if (usedMemorySize > TOTAL_MEMORY_SIZE) {
-        PLOG_FATAL << "Ran out of memory";
+    return true;
+}
 
-        exit(0);
-    }
+// Unmaps a mirror and gives access to the source range back
+void unmirror(u64 srcAddress, u64 dstAddress, u64 pageNum) {
+    PLOG_DEBUG << "Unmirroring " << pageNum << " pages from " << std::hex << srcAddress << " to " << dstAddress;
 
-    memoryBlockRecord.push_back(memoryBlock);
+    auto it = mirrorRecord.find(dstAddress);
 
-    return memoryBlock.mem;
-}
+    if ((it == mirrorRecord.end()) || (it->second.front().address != srcAddress) || (it->second.back().address + it->second.back().pageNum * PAGE_SIZE != srcAddress + pageNum * PAGE_SIZE) || !isMirrorOf(srcAddress, dstAddress, pageNum)) {
+        PLOG_FATAL << "Memory @ " << std::hex << dstAddress << " is not a mirror of " << srcAddress;
 
-u64 allocateTLS() {
-    static u64 TLS_BASE = MemoryBase::TLSBase;
+        exit(0);
+    }
 
-    (void)allocate(TLS_BASE, 1, 0, 0, MemoryPermission::RW);
+    unmap(dstAddress, pageNum);
 
-    const u64 tlsBase = TLS_BASE;
+    for (const MirroredRange &srcRange : it->second) {
+        reprotect(srcRange.address, srcRange.pageNum, srcRange.permission);
+    }
 
-    TLS_BASE += PAGE_SIZE;
+    setAttribute(srcAddress, pageNum, MemoryAttribute::Locked, 0);
 
-    return tlsBase;
+    mirrorRecord.erase(it);
 }
 
 MemoryBlock queryMemory(u64 addr) {
     PLOG_VERBOSE << "Querying memory (addr = " << std::hex << addr << ")";
 
-    for (const auto &memoryBlock : memoryBlockRecord) {
-        if ((addr >= memoryBlock.baseAddress) && (addr < (memoryBlock.baseAddress + PAGE_SIZE * memoryBlock.size))) {
-            return memoryBlock;
-        }
+    if (addr >= MemoryBase::AddressSpace) {
+        // Everything past the end of the address space is inaccessible
+        return MemoryBlock{.baseAddress = MemoryBase::AddressSpace, .size = (0 - MemoryBase::AddressSpace) >> PAGE_SHIFT, .type = MemoryType::Inaccessible, .attribute = 0, .permission = MemoryPermission::None, .mem = NULL};
     }
 
-    PLOG_VERBOSE << "Memory block does not exist";
+    return findBlock(addr)->second;
+}
+
+const std::map<u64, MemoryBlock> &getMemoryBlocks() {
+    return memoryBlockRecord;
+}
+
+// Returns true if every store to a block sets dirty bits
+// NOTE: memory we don't own can be written by HLE code directly (or through a mirror)
+bool isTracked(const MemoryBlock &memoryBlock) {
+    if (!isOwned(memoryBlock) || ((memoryBlock.attribute & MemoryAttribute::Locked) != 0)) {
+        return false;
+    }
 
-    // Returning an address-size pair outside the address space seems to do the trick
-    return MemoryBlock{.baseAddress = MemoryBase::AddressSpace, .size = MemoryBase::AddressSpace, .type = 0, .attribute = 0, .permission = 0, .mem = NULL};
+    return ((memoryBlock.permission & MemoryPermission::W) == 0) || ((memoryBlock.permission & MemoryPermission::R) != 0);
 }
 
 }
@@ -0,0 +1,176 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "profiler.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <plog/Log.h>
+
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "symbols.hpp"
+
+namespace sys::profiler {
+
+constexpr int FP = 29;
+
+// Set in init(), never changes afterwards
+const char *outputPath = NULL;
+
+// Read by core threads, cleared by dump() (which can run from exit() while other cores are still sampling)
+std::atomic<bool> enabled = false;
+
+// Sampled stacks (innermost frame first) and their sample counts
+std::map<std::vector<u64>, u64> stacks;
+std::mutex stackMutex;
+
+u64 sampleCount = 0;
+
+void init(const char *path) {
+    outputPath = path;
+
+    if (outputPath == NULL) {
+        return;
+    }
+
+    PLOG_INFO << "Profiling guest code, writing to " << outputPath;
+
+    enabled = true;
+
+    // Also covers fatal errors
+    std::atexit(dump);
+}
+
+bool isEnabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+// Reads a frame record without faulting on bad frame pointers
+static bool readFrame(u64 fp, u64 &nextFP, u64 &returnAddress) {
+    if ((fp == 0) || ((fp & 0xF) != 0) || (fp > (memory::MemoryBase::AddressSpace - 2 * sizeof(u64)))) {
+        return false;
+    }
+
+    // Frame records never cross a page, thanks to the alignment
+    const u64 *record = (const u64 *)memory::getReadPointer(fp);
+
+    if (record == NULL) {
+        return false;
+    }
+
+    nextFP = record[0];
+    returnAddress = record[1];
+
+    return true;
+}
+
+void sample() {
+    std::vector<u64> stack;
+    stack.reserve(MAX_DEPTH);
+
+    stack.push_back(cpu::getPC());
+
+    u64 fp = cpu::get(FP);
+
+    while ((int)stack.size() < MAX_DEPTH) {
+        u64 nextFP, returnAddress;
+
+        if (!readFrame(fp, nextFP, returnAddress) || (returnAddress == 0)) {
+            break;
+        }
+
+        stack.push_back(returnAddress);
+
+        // Frames have to move up the stack
+        if (nextFP <= fp) {
+            break;
+        }
+
+        fp = nextFP;
+    }
+
+    const std::lock_guard<std::mutex> lock(stackMutex);
+
+    stacks[stack]++;
+    sampleCount++;
+}
+
+static std::string getFrameName(u64 address) {
+    const loader::symbols::Symbol *symbol = loader::symbols::lookup(address);
+
+    if (symbol != NULL) {
+        return symbol->name;
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "0x%llx", (unsigned long long)address);
+
+    return std::string(name);
+}
+
+void dump() {
+    // Only dump once
+    if (!enabled.exchange(false)) {
+        return;
+    }
+
+    const std::lock_guard<std::mutex> lock(stackMutex);
+
+    // Collapse stacks into symbolized frames
+    std::map<std::string, u64> foldedStacks;
+
+    for (const auto &[stack, count] : stacks) {
+        std::string folded;
+
+        for (auto it = stack.rbegin(); it != stack.rend(); it++) {
+            if (!folded.empty()) {
+                folded += ';';
+            }
+
+            folded += getFrameName(*it);
+        }
+
+        foldedStacks[folded] += count;
+    }
+
+    FILE *file = std::fopen(outputPath, "w");
+
+    if (file == NULL) {
+        PLOG_ERROR << "Unable to open profiler output " << outputPath;
+
+        return;
+    }
+
+    for (const auto &[folded, count] : foldedStacks) {
+        std::fprintf(file, "%s %llu\n", folded.c_str(), (unsigned long long)count);
+    }
+
+    std::fclose(file);
+
+    PLOG_INFO << "Wrote " << sampleCount << " samples (" << foldedStacks.size() << " unique stacks) to " << outputPath;
+}
+
+}
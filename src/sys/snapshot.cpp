@@ -0,0 +1,339 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "snapshot.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <plog/Log.h>
+
+#include "buffer_queue.hpp"
+#include "compute.hpp"
+#include "config.hpp"
+#include "cpu.hpp"
+#include "fermi.hpp"
+#include "handle_table.hpp"
+#include "host1x.hpp"
+#include "kepler.hpp"
+#include "kernel.hpp"
+#include "maxwell.hpp"
+#include "memory.hpp"
+#include "nvhost_ctrl.hpp"
+#include "nvmap.hpp"
+
+namespace sys::snapshot {
+
+using hle::KThread;
+
+using Page = std::array<u8, memory::PAGE_SIZE>;
+
+// Only the guest-visible state of a thread, the object itself is left alone
+struct ThreadState {
+    KThread *thread;
+
+    hle::ThreadContext ctx;
+
+    hle::ThreadStatus status;
+
+    i32 priority, processorID;
+};
+
+struct Snapshot {
+    std::map<u64, memory::MemoryBlock> memoryBlocks;
+
+    // Page contents by guest page, pages that didn't change are shared with the previous snapshot
+    std::map<u64, std::shared_ptr<const Page>> pages;
+
+    // Kernel objects can't be recreated, restoring requires the same handles
+    std::vector<std::pair<hle::Handle, hle::KObject *>> handles;
+
+    std::vector<ThreadState> threads;
+
+    hle::kernel::SchedulerState scheduler;
+
+    // Services and GPU engines
+    nvidia::dev::nvmap::State nvmap;
+    nvidia::dev::nvhost_ctrl::State nvhostCtrl;
+    nvidia::host1x::State host1x;
+    android::buffer_queue::State bufferQueues;
+
+    gpu::maxwell::State maxwell;
+    gpu::kepler::State kepler;
+    gpu::fermi::State fermi;
+    gpu::compute::State compute;
+
+    u64 generation;
+};
+
+std::unique_ptr<Snapshot> snapshot;
+
+std::atomic<bool> takeRequested = false, restoreRequested = false;
+
+// Bumped whenever unsaved state changes
+std::atomic<u64> generation = 0;
+std::atomic<const char *> invalidationReason = "";
+
+void requestTake() {
+    takeRequested = true;
+}
+
+void requestRestore() {
+    restoreRequested = true;
+}
+
+void update(u64 frame) {
+    if (frame == config::getSnapshotFrame()) {
+        takeRequested = true;
+    }
+
+    if (takeRequested.exchange(false)) {
+        take();
+    }
+
+    if (restoreRequested.exchange(false) && !restore()) {
+        PLOG_ERROR << "Failed to restore snapshot";
+    }
+}
+
+bool hasSnapshot() {
+    return snapshot != nullptr;
+}
+
+void invalidate(const char *reason) {
+    invalidationReason = reason;
+
+    generation++;
+}
+
+u64 getMemorySize() {
+    return (snapshot != nullptr) ? snapshot->pages.size() * sizeof(Page) : 0;
+}
+
+static bool isSameLayout(const std::map<u64, memory::MemoryBlock> &a, const std::map<u64, memory::MemoryBlock> &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (auto itA = a.begin(), itB = b.begin(); itA != a.end(); itA++, itB++) {
+        const memory::MemoryBlock &blockA = itA->second, &blockB = itB->second;
+
+        if ((blockA.baseAddress != blockB.baseAddress) || (blockA.size != blockB.size) || (blockA.permission != blockB.permission) || (blockA.mem != blockB.mem)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool isSameHandles(const std::vector<std::pair<hle::Handle, hle::KObject *>> &a, const std::vector<std::pair<hle::Handle, hle::KObject *>> &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.size(); i++) {
+        if ((a[i].first.raw != b[i].first.raw) || (a[i].second != b[i].second)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Syncs (or loads) the contexts of threads running on each core
+static void syncActiveThreads(bool load) {
+    const int coreID = cpu::getCoreID();
+
+    for (int core = 0; core < cpu::CORE_NUM; core++) {
+        cpu::setCoreID(core);
+
+        KThread *thread = hle::kernel::getActiveThread();
+
+        if (thread == NULL) {
+            continue;
+        }
+
+        if (load) {
+            cpu::setContext(thread);
+        } else {
+            cpu::getContext(thread);
+        }
+    }
+
+    cpu::setCoreID(coreID);
+}
+
+void take() {
+    const auto startTime = std::chrono::steady_clock::now();
+
+    auto newSnapshot = std::make_unique<Snapshot>();
+
+    newSnapshot->memoryBlocks = memory::getMemoryBlocks();
+
+    // Pages that weren't written since the last snapshot can be shared with it
+    const bool isIncremental = memory::isDirtyTracking() && (snapshot != nullptr);
+
+    u64 copiedPages = 0;
+
+    for (const auto &[address, memoryBlock] : newSnapshot->memoryBlocks) {
+        if (memoryBlock.mem == NULL) {
+            continue;
+        }
+
+        const bool isBlockTracked = memory::isTracked(memoryBlock);
+
+        for (u64 page = 0; page < memoryBlock.size; page++) {
+            const u64 pageAddress = address + page * memory::PAGE_SIZE;
+
+            if (isIncremental && isBlockTracked && !memory::isDirty(pageAddress, memory::PAGE_SIZE)) {
+                auto it = snapshot->pages.find(pageAddress >> memory::PAGE_SHIFT);
+
+                if (it != snapshot->pages.end()) {
+                    newSnapshot->pages.emplace_hint(newSnapshot->pages.end(), it->first, it->second);
+
+                    continue;
+                }
+            }
+
+            auto data = std::make_shared<Page>();
+
+            std::memcpy(data->data(), &((const u8 *)memoryBlock.mem)[page * memory::PAGE_SIZE], memory::PAGE_SIZE);
+
+            newSnapshot->pages.emplace_hint(newSnapshot->pages.end(), pageAddress >> memory::PAGE_SHIFT, std::move(data));
+
+            copiedPages++;
+        }
+    }
+
+    syncActiveThreads(false);
+
+    newSnapshot->handles = hle::kernel::table::getHandles();
+
+    for (hle::KObject *object : hle::kernel::table::getObjects(hle::HandleType::KThread)) {
+        KThread *thread = (KThread *)object;
+
+        newSnapshot->threads.push_back(ThreadState{.thread = thread, .ctx = *thread->getCtx(), .status = thread->getStatus(), .priority = thread->getPriority(), .processorID = thread->getProcessorID()});
+    }
+
+    hle::kernel::getSchedulerState(newSnapshot->scheduler);
+
+    nvidia::dev::nvmap::getState(newSnapshot->nvmap);
+    nvidia::dev::nvhost_ctrl::getState(newSnapshot->nvhostCtrl);
+    nvidia::host1x::getState(newSnapshot->host1x);
+    android::buffer_queue::getState(newSnapshot->bufferQueues);
+
+    gpu::maxwell::getState(newSnapshot->maxwell);
+    gpu::kepler::getState(newSnapshot->kepler);
+    gpu::fermi::getState(newSnapshot->fermi);
+    gpu::compute::getState(newSnapshot->compute);
+
+    newSnapshot->generation = generation;
+
+    snapshot = std::move(newSnapshot);
+
+    // Everything written from now on goes into the next snapshot
+    memory::setDirtyTracking(true);
+    memory::clearDirty(0, memory::MemoryBase::AddressSpace);
+
+    const auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+
+    PLOG_INFO << "Took " << (isIncremental ? "incremental " : "") << "snapshot (" << copiedPages << "/" << snapshot->pages.size() << " pages copied, " << snapshot->threads.size() << " threads) in " << time << " us";
+}
+
+bool restore() {
+    if (snapshot == nullptr) {
+        PLOG_ERROR << "No snapshot to restore";
+
+        return false;
+    }
+
+    // Mappings and threads can't be recreated, they have to match
+    if (!isSameLayout(snapshot->memoryBlocks, memory::getMemoryBlocks())) {
+        PLOG_ERROR << "Guest memory layout changed since the snapshot was taken";
+
+        return false;
+    }
+
+    if (!isSameHandles(snapshot->handles, hle::kernel::table::getHandles())) {
+        PLOG_ERROR << "Kernel objects were created or closed since the snapshot was taken";
+
+        return false;
+    }
+
+    if (snapshot->generation != generation) {
+        PLOG_ERROR << "Unsaved state changed since the snapshot was taken (" << invalidationReason.load() << ")";
+
+        return false;
+    }
+
+    for (const auto &[address, memoryBlock] : snapshot->memoryBlocks) {
+        if (memoryBlock.mem == NULL) {
+            continue;
+        }
+
+        for (u64 page = 0; page < memoryBlock.size; page++) {
+            const Page &data = *snapshot->pages.at((address >> memory::PAGE_SHIFT) + page);
+
+            std::memcpy(&((u8 *)memoryBlock.mem)[page * memory::PAGE_SIZE], data.data(), memory::PAGE_SIZE);
+        }
+
+        // Code may have changed
+        if ((memoryBlock.permission & memory::MemoryPermission::X) != 0) {
+            cpu::invalidateCacheRange(address, memoryBlock.size * memory::PAGE_SIZE);
+        }
+    }
+
+    for (const ThreadState &state : snapshot->threads) {
+        KThread *thread = state.thread;
+
+        *thread->getCtx() = state.ctx;
+
+        thread->setStatus(state.status);
+        thread->setPriority(state.priority);
+        thread->setProcessorID(state.processorID);
+    }
+
+    hle::kernel::setSchedulerState(snapshot->scheduler);
+
+    nvidia::dev::nvmap::setState(snapshot->nvmap);
+    nvidia::dev::nvhost_ctrl::setState(snapshot->nvhostCtrl);
+    nvidia::host1x::setState(snapshot->host1x);
+    android::buffer_queue::setState(snapshot->bufferQueues);
+
+    gpu::maxwell::setState(snapshot->maxwell);
+    gpu::kepler::setState(snapshot->kepler);
+    gpu::fermi::setState(snapshot->fermi);
+    gpu::compute::setState(snapshot->compute);
+
+    syncActiveThreads(true);
+
+    // Memory matches the snapshot again
+    memory::clearDirty(0, memory::MemoryBase::AddressSpace);
+
+    PLOG_INFO << "Restored snapshot";
+
+    return true;
+}
+
+}
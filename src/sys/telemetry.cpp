@@ -0,0 +1,186 @@
+/*
+    Nozomi is an experimental HLE Switch emulator.
+    Copyright (C) 2023  noumidev
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "telemetry.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <plog/Log.h>
+
+#include "arena.hpp"
+#include "config.hpp"
+#include "cpu.hpp"
+#include "memory.hpp"
+#include "snapshot.hpp"
+
+namespace sys::telemetry {
+
+// NOTE: guest memory is accounted under the kernel lock, GPU mappings aren't
+std::atomic<u64> sizes[Category::NumCategories];
+std::atomic<u64> peakSizes[Category::NumCategories];
+
+static const char *getCategoryName(u32 category) {
+    switch (category) {
+        case Category::Code:
+            return "Code";
+        case Category::Heap:
+            return "Heap";
+        case Category::Stack:
+            return "Stack";
+        case Category::TLS:
+            return "TLS";
+        case Category::SharedMemory:
+            return "Shared memory";
+        case Category::TransferMemory:
+            return "Transfer memory";
+        case Category::GPUMapped:
+            return "GPU-mapped";
+        case Category::Other:
+            return "Other";
+        default:
+            PLOG_FATAL << "Invalid memory category";
+
+            exit(0);
+    }
+}
+
+void add(u32 category, u64 size) {
+    const u64 newSize = sizes[category].fetch_add(size, std::memory_order_relaxed) + size;
+
+    u64 peakSize = peakSizes[category].load(std::memory_order_relaxed);
+
+    while ((newSize > peakSize) && !peakSizes[category].compare_exchange_weak(peakSize, newSize, std::memory_order_relaxed)) {}
+}
+
+void remove(u32 category, u64 size) {
+    sizes[category].fetch_sub(size, std::memory_order_relaxed);
+}
+
+// Returns resident set size in bytes (or 0)
+static u64 getRSS() {
+    FILE *file = std::fopen("/proc/self/statm", "r");
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    unsigned long long size = 0, residentPages = 0;
+
+    if (std::fscanf(file, "%llu %llu", &size, &residentPages) != 2) {
+        residentPages = 0;
+    }
+
+    std::fclose(file);
+
+    return (u64)residentPages * (u64)sysconf(_SC_PAGESIZE);
+}
+
+// Returns resident shared memory in bytes (or 0)
+static u64 getSharedRSS() {
+    FILE *file = std::fopen("/proc/self/status", "r");
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    char line[256];
+
+    unsigned long long size = 0;
+
+    while (std::fgets(line, sizeof(line), file) != NULL) {
+        if ((std::strncmp(line, "RssShmem:", 9) == 0) && (std::sscanf(&line[9], "%llu", &size) == 1)) {
+            break;
+        }
+    }
+
+    std::fclose(file);
+
+    return (u64)size << 10;
+}
+
+static u64 getPeakRSS() {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+
+    return (u64)usage.ru_maxrss << 10;
+}
+
+MemoryStats getMemoryStats() {
+    MemoryStats stats;
+
+    stats.guestSize = 0;
+
+    for (u32 category = 0; category < Category::NumCategories; category++) {
+        stats.size[category] = sizes[category].load(std::memory_order_relaxed);
+        stats.peakSize[category] = peakSizes[category].load(std::memory_order_relaxed);
+
+        if ((category != Category::TransferMemory) && (category != Category::GPUMapped)) {
+            stats.guestSize += stats.size[category];
+        }
+    }
+
+    stats.arenaResidentSize = memory::arena::getResidentSize();
+    stats.pageTableSize = memory::getPageTableSize();
+    stats.snapshotSize = snapshot::getMemorySize();
+    stats.jitCacheSize = cpu::getCodeCacheSize();
+    stats.rss = getRSS();
+    stats.peakRSS = getPeakRSS();
+    stats.sharedRSS = getSharedRSS();
+
+    return stats;
+}
+
+void update(u64 frame) {
+    const u64 interval = config::getMemoryStatsInterval();
+
+    if ((interval != 0) && (frame != 0) && ((frame % interval) == 0)) {
+        dump();
+    }
+}
+
+void dump() {
+    const MemoryStats stats = getMemoryStats();
+
+    PLOG_INFO << "Guest memory: " << (stats.guestSize >> 10) << " KiB";
+
+    for (u32 category = 0; category < Category::NumCategories; category++) {
+        PLOG_INFO << "    " << getCategoryName(category) << ": " << (stats.size[category] >> 10) << " KiB (peak = " << (stats.peakSize[category] >> 10) << " KiB)";
+    }
+
+    // Whatever isn't guest memory, page tables or snapshots is attributed to the emulator itself (translated code included).
+    // Guest memory is shmem, in host-mapped mode its pages are mapped (and counted in the RSS) twice
+    const u64 knownSize = stats.sharedRSS + stats.pageTableSize + stats.snapshotSize;
+
+    PLOG_INFO << "Host RSS: " << (stats.rss >> 10) << " KiB (peak = " << (stats.peakRSS >> 10) << " KiB)";
+    PLOG_INFO << "    Guest memory: " << (stats.arenaResidentSize >> 10) << " KiB (mapped = " << (stats.sharedRSS >> 10) << " KiB)";
+    PLOG_INFO << "    Page tables: " << (stats.pageTableSize >> 10) << " KiB";
+    PLOG_INFO << "    Snapshots: " << (stats.snapshotSize >> 10) << " KiB";
+    PLOG_INFO << "    JIT code caches: " << (stats.jitCacheSize >> 10) << " KiB reserved";
+    PLOG_INFO << "    Other: " << ((stats.rss > knownSize) ? ((stats.rss - knownSize) >> 10) : 0) << " KiB";
+}
+
+}